@@ -0,0 +1,314 @@
+/*
+ * Copyright (c) 2014, Lourival Vieira Neto <lneto@NetBSD.org>.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the Author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include <limits.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include <lauxlib.h>
+
+#include "luautil.h"
+
+#include "accessor.h"
+#include "binary.h"
+#include "layout.h"
+#include "data.h"
+
+/*
+ * under LuaJIT, layouts also have accessors written in Lua, which read the
+ * fields of data objects through the FFI, so the JIT can compile them to
+ * plain loads; the FFI passes the data object itself (i.e., its payload) to
+ * fetch_data(), while fields which cannot be read with 32-bit operations call
+ * the binary_get_uint64() kernel through it as well; as the FFI would pass
+ * any other userdata as well, accessors first check the metatable of their
+ * argument
+ */
+static const char ffi_chunk[ ] =
+	"local get, fetch, meta = ...\n"
+	"local ffi = require'ffi'\n"
+	"return {ffi = ffi, bit = require'bit', cast = ffi.cast,\n"
+	"	getmetatable = getmetatable, meta = meta,\n"
+	"	pointer = ffi.typeof'uint8_t *',\n"
+	"	get = ffi.cast('uint64_t (*)(uint8_t *, size_t, size_t, int)',"
+	" get),\n"
+	"	fetch = ffi.cast('uint8_t *(*)(void *, size_t)', fetch)}";
+
+static const char chunk_header[ ] =
+	"local ffi, bit, get, fetch, getmetatable, meta = ...\n"
+	"local band, bor = bit.band, bit.bor\n"
+	"local lshift, rshift = bit.lshift, bit.rshift\n"
+	"return function (d)\n"
+	"if getmetatable(d) ~= meta then return nil end\n";
+
+#define WORD32_BIT	(32)
+#define WORD32_MOD	"4294967296"
+
+#define LUA_INTEGER_BIT	(sizeof(lua_Integer) * BYTE_BIT)
+
+/* returns the raw data, unless it is shorter than extent or no longer valid */
+static byte_t *
+fetch_data(data_t *data, size_t extent)
+{
+	if (data->length < extent)
+		return NULL;
+
+	return (byte_t *) data_get_ptr(data);
+}
+
+typedef struct {
+	char   chunk[ ACCESSOR_CHUNK_SIZE ];
+	size_t length;
+} source_t;
+
+static void
+append(source_t *source, const char *format, ...)
+{
+	size_t  left = sizeof(source->chunk) - source->length;
+	va_list args;
+
+	va_start(args, format);
+	int n = vsnprintf(source->chunk + source->length, left, format, args);
+	va_end(args);
+
+	if (n > 0)
+		source->length += (size_t) n < left ? (size_t) n : left - 1;
+}
+
+/* appends the bytes from first to last, or from last to first, in a word */
+static void
+append_bytes(source_t *source, size_t first, size_t last, bool reverse)
+{
+	size_t nbytes = last - first + 1;
+
+	if (nbytes == 1) {
+		append(source, "p[%zu]", first);
+		return;
+	}
+
+	append(source, "bor(");
+	for (size_t i = 0; i < nbytes; i++) {
+		size_t pos   = reverse ? last - i : first + i;
+		size_t shift = (nbytes - 1 - i) * BYTE_BIT;
+
+		append(source, i > 0 ? ", " : "");
+		if (shift > 0)
+			append(source, "lshift(p[%zu], %zu)", pos, shift);
+		else
+			append(source, "p[%zu]", pos);
+	}
+	append(source, ")");
+}
+
+static void
+append_number(source_t *source, layout_entry_t *entry)
+{
+	size_t msb_offset = entry->offset % BYTE_BIT;
+	size_t first      = entry->offset / BYTE_BIT;
+	size_t span       = msb_offset + entry->length;
+	size_t last       = first + BIT_TO_BYTE(span) - 1;
+
+	bool big = entry->length <= BYTE_BIT || entry->endian == BIG_ENDIAN;
+	bool aligned = msb_offset == 0 && entry->length % BYTE_BIT == 0;
+
+	if (entry->length > LUA_INTEGER_BIT)
+		append(source, "return nil\n");
+	else if (entry->length == WORD32_BIT && aligned) {
+		/* bit operations return signed 32-bit numbers */
+		append(source, "return ");
+		append_bytes(source, first, last, !big);
+		append(source, " %% " WORD32_MOD "\n");
+	}
+	else if (span <= WORD32_BIT && (big || aligned)) {
+		size_t shift = BYTE_TO_BIT(BIT_TO_BYTE(span)) - span;
+		size_t mask  = ((size_t) 1 << entry->length) - 1;
+
+		append(source, "return band(rshift(");
+		append_bytes(source, first, last, !big);
+		append(source, ", %zu), %zu)\n", shift, mask);
+	}
+	else
+		append(source, "return tonumber(ffi.cast('int64_t', "
+			"get(p, %zu, %zu, %d)))\n", entry->offset,
+			entry->length, entry->endian);
+}
+
+/* pushes a function reading the field of an entry from a data object */
+static bool
+generate_accessor(lua_State *L, layout_entry_t *entry)
+{
+	source_t source;
+	source.length = 0;
+
+	/* varints have no fixed span to be read inline */
+	if (entry->type != LAYOUT_TNUMBER && entry->type != LAYOUT_TSTRING)
+		return false;
+
+	size_t extent = entry->type == LAYOUT_TNUMBER ?
+		BIT_TO_BYTE(entry->offset + entry->length) :
+		entry->offset + entry->length;
+
+	append(&source, "%s", chunk_header);
+	append(&source, "local p = fetch(d, %zu)\n", extent);
+	append(&source, "if p == nil then return nil end\n");
+
+	if (entry->type == LAYOUT_TNUMBER)
+		append_number(&source, entry);
+	else
+		append(&source, "return ffi.string(p + %zu, %zu)\n",
+			entry->offset, entry->length);
+
+	append(&source, "end\n");
+
+	if (luaL_loadstring(L, source.chunk) != 0) {
+		lua_pop(L, 1);
+		return false;
+	}
+
+	lua_getfield(L, LUA_REGISTRYINDEX, ACCESSOR_FFI);
+	lua_getfield(L, -1, "ffi");
+	lua_getfield(L, -2, "bit");
+	lua_getfield(L, -3, "get");
+	lua_getfield(L, -4, "fetch");
+	lua_getfield(L, -5, "getmetatable");
+	lua_getfield(L, -6, "meta");
+	lua_remove(L, -7);
+
+	if (lua_pcall(L, 6, 1, 0) != 0) {
+		lua_pop(L, 1);
+		return false;
+	}
+	return true;
+}
+
+void
+accessor_open(lua_State *L)
+{
+	/* only LuaJIT has the FFI */
+	lua_getglobal(L, "jit");
+	bool jit = lua_istable(L, -1);
+	lua_pop(L, 1);
+	if (!jit)
+		return;
+
+	if (luaL_loadstring(L, ffi_chunk) != 0) {
+		lua_pop(L, 1);
+		return;
+	}
+
+	lua_pushlightuserdata(L, (void *) binary_get_uint64);
+	lua_pushlightuserdata(L, (void *) fetch_data);
+	luaL_newmetatable(L, DATA_USERDATA);
+	if (lua_pcall(L, 3, 1, 0) != 0) {
+		lua_pop(L, 1);
+		return;
+	}
+	lua_setfield(L, LUA_REGISTRYINDEX, ACCESSOR_FFI);
+
+	/* accessors are collected along with their layouts */
+	lua_newtable(L);
+
+	lua_newtable(L);
+	lua_pushstring(L, "k");
+	lua_setfield(L, -2, "__mode");
+	lua_setmetatable(L, -2);
+
+	lua_setfield(L, LUA_REGISTRYINDEX, ACCESSOR_CACHE);
+}
+
+int
+accessor_pushpointer(lua_State *L, void *ptr)
+{
+	lua_getfield(L, LUA_REGISTRYINDEX, ACCESSOR_FFI);
+	if (lua_isnil(L, -1)) {
+		lua_pop(L, 1);
+		lua_pushlightuserdata(L, ptr);
+		return 1;
+	}
+
+	/* ffi.cast(pointer, ptr) */
+	lua_getfield(L, -1, "cast");
+	lua_getfield(L, -2, "pointer");
+	lua_pushlightuserdata(L, ptr);
+	lua_call(L, 2, 1);
+
+	lua_remove(L, -2);
+	return 1;
+}
+
+int
+accessor_push(lua_State *L, int layout_ix)
+{
+	if (layout_ix < 0)
+		layout_ix = lua_gettop(L) + layout_ix + 1;
+
+	lua_getfield(L, LUA_REGISTRYINDEX, ACCESSOR_CACHE);
+	if (lua_isnil(L, -1)) {
+		lua_pop(L, 1);
+		return 0;
+	}
+
+	lua_pushvalue(L, layout_ix);
+	lua_rawget(L, -2);
+	if (!lua_isnil(L, -1)) {
+		/* removes cache; keeps accessors */
+		lua_remove(L, -2);
+		return 1;
+	}
+	lua_pop(L, 1);
+
+	lua_newtable(L);
+	layout_push_fields(L, layout_ix);
+
+	lua_pushnil(L);  /* first key */
+	while (lua_next(L, -2) != 0) {
+		layout_entry_t *entry = (layout_entry_t *)
+			luau_testudata(L, -1, LAYOUT_ENTRY_USERDATA);
+		lua_pop(L, 1);
+
+		if (entry == NULL)
+			continue;
+
+		/* accessors[ key ] = accessor */
+		lua_pushvalue(L, -1);
+		if (generate_accessor(L, entry))
+			lua_rawset(L, -5);
+		else
+			lua_pop(L, 1);
+	}
+	lua_pop(L, 1);
+
+	/* cache[ layout ] = accessors */
+	lua_pushvalue(L, layout_ix);
+	lua_pushvalue(L, -2);
+	lua_rawset(L, -4);
+
+	/* removes cache; keeps accessors */
+	lua_remove(L, -2);
+	return 1;
+}
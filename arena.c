@@ -0,0 +1,117 @@
+/*
+ * Copyright (c) 2014, Lourival Vieira Neto <lneto@NetBSD.org>.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the Author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include <lauxlib.h>
+
+#include "luautil.h"
+
+#include "arena.h"
+
+#define ARENA_ALIGNMENT		(sizeof(void *))
+#define ARENA_ALIGN(size)		((size + ARENA_ALIGNMENT - 1) & ~(ARENA_ALIGNMENT - 1))
+
+arena_t *
+arena_new(lua_State *L, size_t size)
+{
+	size_t aligned = ARENA_ALIGN(size);
+	if (aligned < size || aligned > (size_t) -1 - sizeof(arena_t))
+		luaL_error(L, "not enough memory");
+
+	size = aligned;
+
+	/* the userdata comes first, so errors raised later leak nothing */
+	arena_t **ud = (arena_t **) lua_newuserdata(L, sizeof(arena_t *));
+	*ud = NULL;
+	luau_setmetatable(L, ARENA_USERDATA);
+
+	arena_t *arena = (arena_t *) luau_malloc(L, sizeof(arena_t) + size);
+	if (arena == NULL)
+		luaL_error(L, "not enough memory");
+
+	arena->base       = (char *) (arena + 1);
+	arena->size       = size;
+	arena->used       = 0;
+	arena->generation = 0;
+	arena->refcount   = 0;
+
+#ifdef DATA_STATS
+	/* arenas are accounted as handles owning their whole buffer */
+	arena->stats = stats_get(L);
+	STATS_INC(arena->stats, handles);
+	STATS_ADD(arena->stats, bytes, size);
+#endif
+
+	*ud = arena;
+	return arena;
+}
+
+inline arena_t *
+arena_test(lua_State *L, int index)
+{
+	arena_t **ud = (arena_t **) luau_testudata(L, index, ARENA_USERDATA);
+	return ud != NULL ? *ud : NULL;
+}
+
+void *
+arena_alloc(arena_t *arena, size_t size)
+{
+	/* assertion: arena->size and arena->used are aligned */
+	if (size > arena->size - arena->used)
+		return NULL;
+
+	size = ARENA_ALIGN(size);
+
+	void *ptr = arena->base + arena->used;
+	arena->used += size;
+	return ptr;
+}
+
+void
+arena_reset(arena_t *arena)
+{
+	/* invalidates every data object allocated so far; see data_get_ptr() */
+	arena->generation++;
+	arena->used = 0;
+}
+
+void
+arena_delete(lua_State *L, arena_t *arena)
+{
+	if (arena->refcount == 0) {
+#ifdef DATA_STATS
+		stats_t *stats = arena->stats;
+		STATS_DEC(stats, handles);
+		STATS_SUB(stats, bytes, arena->size);
+#endif
+		luau_free(L, arena, sizeof(arena_t) + arena->size);
+#ifdef DATA_STATS
+		stats_release(L, stats);
+#endif
+	}
+	else
+		arena->refcount--;
+}
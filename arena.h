@@ -0,0 +1,63 @@
+/*
+ * Copyright (c) 2014, Lourival Vieira Neto <lneto@NetBSD.org>.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the Author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#ifndef _ARENA_H_
+#define _ARENA_H_
+
+#ifndef _KERNEL
+#include <stddef.h>
+#include <stdbool.h>
+#endif
+
+#include <lua.h>
+
+#include "stats.h"
+
+#define ARENA_USERDATA	"data.arena"
+
+typedef struct {
+	char   *base;
+	size_t  size;
+	size_t  used;
+	size_t  generation;
+	size_t  refcount;
+#ifdef DATA_STATS
+	stats_t *stats;
+#endif
+} arena_t;
+
+arena_t * arena_new(lua_State *, size_t);
+
+arena_t * arena_test(lua_State *, int);
+
+void * arena_alloc(arena_t *, size_t);
+
+void arena_reset(arena_t *);
+
+void arena_delete(lua_State *, arena_t *);
+
+#endif /* _ARENA_H_ */
@@ -0,0 +1,184 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+#include <assert.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <lua.h>
+#include <lauxlib.h>
+#include <lualib.h>
+
+#include "luadata.h"
+
+/* usage: benchmark [csv | json] [iterations [max_threads]] */
+
+static int json = 0;
+static int nresults = 0;
+static const char *version = NULL;
+
+static double
+now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void
+report(const char *name, long n, double elapsed)
+{
+	double ns = elapsed / n * 1e9;
+
+	if (json)
+		printf("%s\n    {\"name\": \"%s\", \"iterations\": %ld, "
+			"\"ns_per_op\": %.2f}", nresults > 0 ? "," : "",
+			name, n, ns);
+	else
+		printf("%s,%ld,%.2f,%s\n", name, n, ns, version);
+
+	nresults++;
+}
+
+static int
+lua_now(lua_State *L)
+{
+	lua_pushnumber(L, now());
+	return 1;
+}
+
+static int
+lua_report(lua_State *L)
+{
+	const char *name = luaL_checkstring(L, 1);
+	long n = (long) luaL_checkinteger(L, 2);
+	double elapsed = luaL_checknumber(L, 3);
+
+	report(name, n, elapsed);
+	return 0;
+}
+
+/* ldata_newref() and ldata_unref() cycles over the same C buffer */
+static void
+bench_newref(lua_State *L, long n)
+{
+	unsigned char buffer[ 64 ];
+	memset(buffer, 0, sizeof(buffer));
+
+	double start = now();
+	for (long i = 0; i < n; i++) {
+		int r = ldata_newref(L, buffer, sizeof(buffer));
+		lua_pop(L, 1);
+		ldata_unref(L, r);
+	}
+	report("newref_unref", n, now() - start);
+}
+
+/* ldata_newref(), a filter call and ldata_unref(), as a packet hook does */
+static void
+bench_filter(lua_State *L, long n)
+{
+	unsigned char buffer[ 64 ];
+	memset(buffer, 0, sizeof(buffer));
+
+	assert(luaL_dostring(L,
+		"local l = data.layout{byte = {0, 8}}\n"
+		"function filter(d) d:layout(l) return d.byte == 0 end") == 0);
+
+	double start = now();
+	for (long i = 0; i < n; i++) {
+		lua_getglobal(L, "filter");
+		int r = ldata_newref(L, buffer, sizeof(buffer));
+		assert(lua_pcall(L, 1, 1, 0) == 0);
+		lua_pop(L, 1);
+		ldata_unref(L, r);
+	}
+	report("newref_filter_unref", n, now() - start);
+}
+
+/* throughput of a worker pool running bench_pool.lua, by thread count */
+static void
+bench_pool(long n, size_t max_threads)
+{
+	unsigned char buffer[ 64 ];
+	memset(buffer, 0, sizeof(buffer));
+
+	for (size_t nthreads = 1; nthreads <= max_threads; nthreads *= 2) {
+		ldata_pool_t *pool = ldata_pool_create(nthreads,
+			"bench_pool.lua", "filter");
+		assert(pool != NULL);
+
+		double start = now();
+		for (long i = 0; i < n; i++)
+			while (!ldata_pool_submit(pool, buffer, sizeof(buffer),
+				NULL, NULL))
+				;
+
+		/* wait for the queue to be drained */
+		ldata_pool_destroy(pool);
+
+		char name[ 32 ];
+		snprintf(name, sizeof(name), "pool_%zu_threads", nthreads);
+		report(name, n, now() - start);
+	}
+}
+
+int
+main(int argc, char *argv[ ])
+{
+	json = argc > 1 && strcmp(argv[1], "json") == 0;
+	long n = argc > 2 ? atol(argv[2]) : 1000000;
+	size_t max_threads = argc > 3 ? (size_t) atol(argv[3]) : 8;
+
+	/* create a new Lua state */
+	lua_State *L = luaL_newstate();
+	luaL_openlibs(L);
+
+	/* open luadata library */
+#if LUA_VERSION_NUM >= 502
+	luaL_requiref(L, "data", luaopen_data, 1);
+#else
+	luaopen_data(L);
+#endif
+	lua_pop(L, 1);  /* remove lib */
+
+	/* keep _VERSION on the stack */
+	lua_getglobal(L, "_VERSION");
+	version = lua_tostring(L, -1);
+
+	if (json)
+		printf("{\n  \"lua\": \"%s\",\n  \"results\": [", version);
+	else
+		printf("benchmark,iterations,ns_per_op,lua\n");
+
+	lua_pushcfunction(L, lua_now);
+	lua_setglobal(L, "now");
+	lua_pushcfunction(L, lua_report);
+	lua_setglobal(L, "report");
+	lua_pushinteger(L, (lua_Integer) n);
+	lua_setglobal(L, "iterations");
+
+	/* a file descriptor for the I/O benchmarks */
+	int zero = open("/dev/zero", O_RDONLY);
+	lua_pushinteger(L, zero);
+	lua_setglobal(L, "zero_fd");
+
+	bench_newref(L, n);
+	bench_filter(L, n);
+	bench_pool(n, max_threads);
+
+	/* run the Lua benchmarks */
+	if (luaL_dofile(L, "bench.lua") != 0) {
+		fprintf(stderr, "%s\n", lua_tostring(L, -1));
+		return 1;
+	}
+
+	if (json)
+		printf("\n  ]\n}\n");
+
+	lua_close(L);
+	close(zero);
+	return 0;
+}
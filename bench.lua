@@ -0,0 +1,270 @@
+local data = require'data'
+
+-- number of iterations of each benchmark
+local N = tonumber(iterations or arg and arg[1]) or 1000000
+
+-- report(name, iterations, seconds) and now() are provided by bench.c;
+-- fall back to a CSV report and CPU time when running standalone
+local now = now or os.clock
+local report = report or function (name, n, elapsed)
+	print(string.format('%s,%d,%.2f,%s', name, n, elapsed / n * 1e9,
+		_VERSION))
+end
+
+local function bench(name, f, ...)
+	local start = now()
+	f(N, ...)
+	report(name, N, now() - start)
+end
+
+-- empty loop, as a baseline for the others
+bench('loop', function (n)
+	for i = 1, n do end
+end)
+
+-- field access across widths, alignments and endians
+local d = data.new(16)
+for _, width in ipairs{1, 4, 8, 16, 32, 64} do
+	for _, align in ipairs{0, 3} do
+		for _, endian in ipairs{'big', 'little'} do
+			local l = data.layout{
+				field = {align, width, 'number', endian}
+			}
+			d:layout(l)
+
+			local name = string.format('%s_%d_%s',
+				align == 0 and 'aligned' or 'unaligned', width,
+				endian)
+
+			bench('get_' .. name, function (n)
+				local v
+				for i = 1, n do v = d.field end
+			end)
+
+			bench('set_' .. name, function (n)
+				for i = 1, n do d.field = i end
+			end)
+		end
+	end
+end
+
+-- string field access
+d:layout{str = {0, 8, 'string'}}
+
+bench('get_string_8', function (n)
+	local v
+	for i = 1, n do v = d.str end
+end)
+
+bench('set_string_8', function (n)
+	for i = 1, n do d.str = 'abcdefgh' end
+end)
+
+-- data creation
+bench('new_number', function (n)
+	for i = 1, n do data.new(64) end
+end)
+
+local t = {}
+for i = 1, 64 do t[i] = i end
+
+bench('new_table', function (n)
+	for i = 1, n do data.new(t) end
+end)
+
+local s = string.rep('x', 64)
+
+bench('new_string', function (n)
+	for i = 1, n do data.new(s) end
+end)
+
+-- segment creation
+bench('segment', function (n)
+	for i = 1, n do d:segment(4, 8) end
+end)
+
+-- layout application
+local l = data.layout{byte = {0, 8}, word = {8, 32}}
+
+bench('layout_stamped', function (n)
+	for i = 1, n do d:layout(l) end
+end)
+
+bench('layout_table', function (n)
+	for i = 1, n do d:layout{byte = {0, 8}, word = {8, 32}} end
+end)
+
+-- decoding a TCP over IPv4 frame, as the usual chain of layouts does
+d = data.new(64)
+d:layout{type = {96, 16}, version = {112, 4}, ihl = {116, 4},
+	protocol = {184, 8}, offset = {320, 4}}
+d.type, d.version, d.ihl, d.protocol, d.offset = 0x0800, 4, 5, 6, 5
+d:segment(16, 2):layout{length = {0, 16}}.length = 50
+
+local layouts = data.layouts
+local layers = {}
+
+bench('decode_tcp_ipv4', function (n)
+	for i = 1, n do d:decode(layers) end
+end)
+
+bench('chain_tcp_ipv4', function (n)
+	for i = 1, n do
+		local eth = d:segment(0, 14):layout(layouts.ethernet)
+		if eth.type == 0x0800 then
+			local ip = d:segment(14):layout(layouts.ipv4)
+			if ip.protocol == 6 then
+				local tcp = ip:segment(ip.ihl * 4):layout(layouts.tcp)
+				local payload = tcp:segment(tcp.offset * 4)
+			end
+		end
+	end
+end)
+
+-- fields sharing a word, by index and unpacked
+d = data.new(20)
+d:layout{version = {0, 4}, ihl = {4, 4}, dscp = {8, 6}, ecn = {14, 2}}
+
+bench('index_4_fields', function (n)
+	local a, b, c, e
+	for i = 1, n do
+		a, b, c, e = d.version, d.ihl, d.dscp, d.ecn
+	end
+end)
+
+bench('unpack_4_fields', function (n)
+	local a, b, c, e
+	for i = 1, n do
+		a, b, c, e = d:unpack('version', 'ihl', 'dscp', 'ecn')
+	end
+end)
+
+-- a field through a precompiled accessor
+local l = data.layout{version = {0, 4}, ihl = {4, 4}, dscp = {8, 6},
+	ecn = {14, 2}}
+local version = l:accessor('version')
+
+bench('index_field', function (n)
+	local v
+	for i = 1, n do v = d.version end
+end)
+
+bench('accessor_field', function (n)
+	local v
+	for i = 1, n do v = version(d) end
+end)
+
+-- fields sharing a word, through FFI accessors (LuaJIT only)
+local a = data.accessors{version = {0, 4}, ihl = {4, 4}, dscp = {8, 6},
+	ecn = {14, 2}}
+if a then
+	local version, ihl, dscp, ecn = a.version, a.ihl, a.dscp, a.ecn
+	bench('accessor_4_fields', function (n)
+		local a, b, c, e
+		for i = 1, n do
+			a, b, c, e = version(d), ihl(d), dscp(d), ecn(d)
+		end
+	end)
+end
+
+-- iterating over TLV elements
+d = data.new{1, 2, 0, 0, 2, 1, 0, 3, 0, 4, 4, 0, 0, 0, 0}
+
+bench('tlv_4_elements', function (n)
+	for i = 1, n do
+		for type, value in d:tlv(1, 1) do end
+	end
+end)
+
+-- longest-prefix match on an address field, in place
+local routes = data.lpm()
+for i = 0, 255 do routes:insert(string.char(10, i), 16, i) end
+routes:insert(string.char(10, 1, 2), 24, 'route')
+d = data.new{10, 1, 2, 3}
+d:layout{dst = {0, 32}}
+
+bench('lpm_lookup_field', function (n)
+	local v
+	for i = 1, n do v = routes:lookup(d, 'dst') end
+end)
+
+-- flow table keyed by fields, against a table keyed by strings
+d = data.new{10, 0, 0, 1, 10, 0, 0, 2, 0x1f, 0x90, 0x00, 0x50}
+d:layout{src = {0, 32}, dst = {32, 32}, sport = {64, 16}, dport = {80, 16}}
+local flows = data.map{layout = {src = {0, 32}, dst = {32, 32},
+	sport = {64, 16}, dport = {80, 16}},
+	fields = {'src', 'dst', 'sport', 'dport'}, capacity = 1024}
+
+bench('map_upsert_flow', function (n)
+	for i = 1, n do
+		d.sport = i % 1024
+		flows:upsert(d)
+	end
+end)
+
+local tflows = {}
+bench('table_upsert_flow', function (n)
+	for i = 1, n do
+		d.sport = i % 1024
+		local key = d:tostring(0, 12)
+		tflows[key] = tflows[key] or true
+	end
+end)
+
+-- encoding a full-sized frame, and decoding it back
+d = data.new(string.rep('\x5a\xa5\x0f', 500))
+local hex, base64 = d:hex(), d:base64()
+
+bench('hex_1500', function (n)
+	for i = 1, n do d:hex() end
+end)
+
+bench('base64_1500', function (n)
+	for i = 1, n do d:base64() end
+end)
+
+bench('fromhex_1500', function (n)
+	for i = 1, n do data.fromhex(hex) end
+end)
+
+bench('frombase64_1500', function (n)
+	for i = 1, n do data.frombase64(base64) end
+end)
+
+-- reading a full-sized frame in place, against through a string
+-- (zero_fd is provided by bench.c)
+if zero_fd and zero_fd >= 0 then
+	d = data.new(1500)
+	local f = io.open('/dev/zero', 'rb')
+
+	bench('read_from_1500', function (n)
+		for i = 1, n do d:read_from(zero_fd) end
+	end)
+
+	bench('read_string_1500', function (n)
+		for i = 1, n do data.new(f:read(1500)) end
+	end)
+
+	f:close()
+end
+
+-- iterating over the packets of a capture file, in place
+local path = os.tmpname()
+os.remove(path)
+local w = data.pcap_writer(path)
+d = data.new(64)
+for i = 1, 1000 do w:write(d, i, 0) end
+w:close()
+
+local capture = data.pcap_open(path)
+bench('pcap_packet', function (n)
+	local i = 0
+	while i < n do
+		for pkt, sec in capture:packets() do
+			i = i + 1
+			if i == n then break end
+		end
+	end
+end)
+capture:close()
+os.remove(path)
@@ -0,0 +1,9 @@
+local data = require'data'
+
+local l = data.layout{byte = {0, 8}}
+
+-- called by the pool workers of bench.c for each buffer
+function filter(d)
+	d:layout(l)
+	return d.byte == 0
+end
@@ -174,6 +174,9 @@ binary_set_uint64(byte_t *bytes, size_t offset, size_t width, int endian,
 	size_t overflow   = OVERFLOW_BITS(width, msb_offset, lsb_offset);
 	byte_t clear_mask = ~MASK(msb_offset, lsb_offset);
 
+	/* bits beyond the field width must not leak into its neighbors */
+	value &= UINT64_MAX >> VALUE_MSB_OFFSET(width);
+
 	if (NEED_SWAP(width, endian))
 		swap_bytes_out(&value, width);
 
@@ -192,3 +195,67 @@ binary_set_uint64(byte_t *bytes, size_t offset, size_t width, int endian,
 		bytes[   pos ] |= value << overflow_lsb_offset;
 	}
 }
+
+/* loads the big-endian word starting at bytes */
+uint64_t
+binary_get_word(byte_t *bytes)
+{
+	uint64_t word = 0;
+
+	for (size_t pos = 0; pos < BINARY_WORD_BYTE; pos++)
+		word = (word << BYTE_BIT) | bytes[ pos ];
+
+	return word;
+}
+
+#define VARINT_MORE	(0x80)
+#define VARINT_BITS	(7)
+#define VARINT_MASK	(0x7f)
+
+/*
+ * decodes the LEB128 varint starting at bytes, which spans at most size
+ * bytes; returns the number of bytes it takes, or 0 if it is truncated or
+ * overflows 64 bits
+ */
+size_t
+binary_get_varint(byte_t *bytes, size_t size, uint64_t *value)
+{
+	uint64_t result = 0;
+
+	size = MIN(size, BINARY_VARINT_MAX);
+	for (size_t pos = 0; pos < size; pos++) {
+		uint64_t bits = bytes[ pos ] & VARINT_MASK;
+		size_t   shift = pos * VARINT_BITS;
+
+		/* the last byte holds a single bit of a 64-bit value */
+		if (shift == UINT64_BIT - 1 && bits > 1)
+			return 0;
+
+		result |= bits << shift;
+		if ((bytes[ pos ] & VARINT_MORE) == 0) {
+			*value = result;
+			return pos + 1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * encodes value as a LEB128 varint of exactly size bytes, padding it with
+ * continuation bytes; returns false if it does not fit
+ */
+bool
+binary_set_varint(byte_t *bytes, size_t size, uint64_t value)
+{
+	if (size == 0 || size > BINARY_VARINT_MAX ||
+	    (size * VARINT_BITS < UINT64_BIT &&
+	     value >> (size * VARINT_BITS) != 0))
+		return false;
+
+	for (size_t pos = 0; pos < size - 1; pos++) {
+		bytes[ pos ] = (value & VARINT_MASK) | VARINT_MORE;
+		value >>= VARINT_BITS;
+	}
+	bytes[ size - 1 ] = value;
+	return true;
+}
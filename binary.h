@@ -33,6 +33,7 @@
 #ifndef _KERNEL
 #include <stddef.h>
 #include <stdint.h>
+#include <stdbool.h>
 #else
 #if defined(__NetBSD__)
 #include <sys/types.h>
@@ -49,6 +50,28 @@ uint64_t binary_get_uint64(byte_t *, size_t, size_t, int);
 
 void binary_set_uint64(byte_t *, size_t, size_t, int, uint64_t);
 
+#define BINARY_WORD_BIT		(64)
+#define BINARY_WORD_BYTE	(8)
+
+uint64_t binary_get_word(byte_t *);
+
+/* extracts width bits of a word, which are followed by shift bits */
+#define BINARY_EXTRACT(word, shift, width) \
+	((word) >> (shift) & (UINT64_MAX >> (BINARY_WORD_BIT - (width))))
+
+/* a LEB128 varint of a 64-bit value takes up to 10 bytes */
+#define BINARY_VARINT_MAX	(10)
+
+size_t binary_get_varint(byte_t *, size_t, uint64_t *);
+
+bool binary_set_varint(byte_t *, size_t, uint64_t);
+
+/* maps signed values to unsigned ones, small magnitudes to small values */
+#define BINARY_ZIGZAG_ENCODE(value) \
+	(((uint64_t) (value) << 1) ^ (uint64_t) -((uint64_t) (value) >> 63))
+#define BINARY_ZIGZAG_DECODE(value) \
+	((int64_t) ((value) >> 1 ^ -((value) & 1)))
+
 #define CEIL_DIV(x, y)	((x + y - 1) / y)
 #define BIT_TO_BYTE(x)	(CEIL_DIV(x, BYTE_BIT))
 #define BYTE_TO_BIT(x)	(x * BYTE_BIT)
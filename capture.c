@@ -0,0 +1,548 @@
+/*
+ * Copyright (c) 2014, Lourival Vieira Neto <lneto@NetBSD.org>.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the Author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/param.h>
+#include <sys/stat.h>
+#include <sys/endian.h>
+
+#include <lauxlib.h>
+
+#include "luautil.h"
+
+#include "capture.h"
+
+#define PCAP_MAGIC		(0xa1b2c3d4)
+#define PCAP_MAGIC_NSEC		(0xa1b23c4d)
+#define PCAP_HEADER_SIZE	(24)
+#define PCAP_RECORD_SIZE	(16)
+#define PCAP_SNAPLEN		(262144)
+
+#define PCAPNG_SHB		(0x0a0d0d0a)
+#define PCAPNG_IDB		(1)
+#define PCAPNG_PB		(2)
+#define PCAPNG_SPB		(3)
+#define PCAPNG_EPB		(6)
+#define PCAPNG_BOM		(0x1a2b3c4d)
+#define PCAPNG_BLOCK_MIN	(12)	/* type and both lengths */
+#define PCAPNG_SHB_MIN		(28)
+#define PCAPNG_OPT_ENDOFOPT	(0)
+#define PCAPNG_IF_TSRESOL	(9)
+
+#define NSEC_PER_SEC	(1000000000ULL)
+#define USEC_PER_SEC	(1000000ULL)
+
+#define PAD4(length)	(((size_t) (length) + 3) & ~(size_t) 3)
+
+/* results of reading a record or block, other than a packet */
+#define NEXT_END	(0)
+#define NEXT_SKIP	(-1)
+
+static uint16_t
+get16(const byte_t *ptr, bool swapped)
+{
+	uint16_t value;
+	memcpy(&value, ptr, sizeof(value));
+	return swapped ? bswap16(value) : value;
+}
+
+static uint32_t
+get32(const byte_t *ptr, bool swapped)
+{
+	uint32_t value;
+	memcpy(&value, ptr, sizeof(value));
+	return swapped ? bswap32(value) : value;
+}
+
+static void
+set16(byte_t *ptr, uint16_t value, bool swapped)
+{
+	value = swapped ? bswap16(value) : value;
+	memcpy(ptr, &value, sizeof(value));
+}
+
+static void
+set32(byte_t *ptr, uint32_t value, bool swapped)
+{
+	value = swapped ? bswap32(value) : value;
+	memcpy(ptr, &value, sizeof(value));
+}
+
+/* recognizes the magic of a pcap file in either byte order */
+static bool
+pcap_magic(uint32_t magic, bool *swapped, uint64_t *units)
+{
+	*swapped = magic == bswap32(PCAP_MAGIC) ||
+		magic == bswap32(PCAP_MAGIC_NSEC);
+	if (*swapped)
+		magic = bswap32(magic);
+
+	*units = magic == PCAP_MAGIC_NSEC ? NSEC_PER_SEC : USEC_PER_SEC;
+	return magic == PCAP_MAGIC || magic == PCAP_MAGIC_NSEC;
+}
+
+static uint32_t
+to_nanoseconds(uint64_t fraction, uint64_t units)
+{
+	if (units <= NSEC_PER_SEC && NSEC_PER_SEC % units == 0)
+		return (uint32_t) (fraction * (NSEC_PER_SEC / units));
+
+	return (uint32_t) ((double) fraction * NSEC_PER_SEC / units);
+}
+
+capture_t *
+capture_open(lua_State *L, const char *path)
+{
+	/* created first, so a memory error cannot leak the mapping */
+	capture_t *capture = (capture_t *) lua_newuserdata(L,
+		sizeof(capture_t));
+	capture->map    = NULL;
+	capture->size   = 0;
+	capture->handle = NULL;
+	capture->ng     = false;
+	luau_setmetatable(L, CAPTURE_USERDATA);
+
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		goto fail;
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size < PCAP_HEADER_SIZE) {
+		close(fd);
+		goto fail;
+	}
+
+	size_t  size = (size_t) st.st_size;
+	byte_t *map  = (byte_t *) mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd,
+		0);
+	close(fd);
+	if (map == MAP_FAILED)
+		goto fail;
+
+	capture->map  = map;
+	capture->size = size;
+
+	bool     swapped;
+	uint64_t units;
+	capture->ng = get32(map, false) == PCAPNG_SHB;
+	if (!capture->ng && !pcap_magic(get32(map, false), &swapped, &units)) {
+		capture_close(L, capture);
+		goto fail;
+	}
+
+	/* packets are mostly read once, in file order */
+	posix_madvise(map, size, POSIX_MADV_SEQUENTIAL);
+
+	/* packets are segments of a read-only data object of the whole file */
+	lua_newtable(L);
+	data_t *data = data_new(L, map, size, false);
+	capture->handle = data->handle;
+	capture->handle->readonly = true;
+	capture->handle->refcount++;
+	lua_rawseti(L, -2, 1);
+	luau_setuservalue(L, -2);
+	return capture;
+fail:
+	lua_pop(L, 1);
+	return NULL;
+}
+
+void
+capture_init(capture_t *capture, capture_state_t *state)
+{
+	memset(state, 0, sizeof(capture_state_t));
+	state->ng = capture->ng;
+	if (state->ng)
+		return;
+
+	capture_interface_t *interface = &state->interfaces[ 0 ];
+	pcap_magic(get32(capture->map, false), &state->swapped,
+		&interface->units);
+	interface->snaplen  = get32(capture->map + 16, state->swapped);
+	interface->linktype = (uint16_t) get32(capture->map + 20,
+		state->swapped);
+
+	state->ninterfaces = 1;
+	state->position    = PCAP_HEADER_SIZE;
+}
+
+static int
+next_record(data_t *data, const byte_t *ptr, data_t *cursor,
+	capture_state_t *state, capture_packet_t *packet)
+{
+	size_t position = state->position;
+	if (data->length - position < PCAP_RECORD_SIZE)
+		return NEXT_END;
+
+	const byte_t *record = ptr + position;
+	bool swapped = state->swapped;
+
+	/* a truncated record ends the iteration, as if not written yet */
+	uint32_t captured = get32(record + 8, swapped);
+	if (captured > data->length - position - PCAP_RECORD_SIZE)
+		return NEXT_END;
+
+	capture_interface_t *interface = &state->interfaces[ 0 ];
+	packet->seconds     = get32(record, swapped);
+	packet->nanoseconds = to_nanoseconds(get32(record + 4, swapped),
+		interface->units);
+	packet->length      = get32(record + 12, swapped);
+	packet->linktype    = interface->linktype;
+
+	state->position = position + PCAP_RECORD_SIZE + captured;
+	if (captured == 0)
+		return NEXT_SKIP;
+
+	return data_move_segment(cursor, data, position + PCAP_RECORD_SIZE,
+		captured) ? 1 : NEXT_END;
+}
+
+static int
+invalid(capture_state_t *state)
+{
+	state->invalid = true;
+	return NEXT_END;
+}
+
+static int
+next_section(capture_state_t *state, const byte_t *block, size_t remaining)
+{
+	if (remaining < PCAPNG_SHB_MIN)
+		return NEXT_END;
+
+	uint32_t bom = get32(block + 8, false);
+	if (bom != PCAPNG_BOM && bom != bswap32(PCAPNG_BOM))
+		return invalid(state);
+
+	/* interfaces are numbered per section */
+	state->swapped     = bom != PCAPNG_BOM;
+	state->ninterfaces = 0;
+	return NEXT_SKIP;
+}
+
+static int
+next_interface(capture_state_t *state, const byte_t *body, size_t length)
+{
+	if (length < 8 || state->ninterfaces == CAPTURE_MAX_INTERFACES)
+		return invalid(state);
+
+	bool swapped = state->swapped;
+	capture_interface_t *interface =
+		&state->interfaces[ state->ninterfaces++ ];
+	interface->linktype = get16(body, swapped);
+	interface->snaplen  = get32(body + 4, swapped);
+	interface->units    = USEC_PER_SEC;
+
+	size_t offset = 8;
+	while (length - offset >= 4) {
+		uint16_t code  = get16(body + offset, swapped);
+		uint16_t value = get16(body + offset + 2, swapped);
+		if (code == PCAPNG_OPT_ENDOFOPT)
+			break;
+
+		if (value > length - offset - 4)
+			return invalid(state);
+
+		if (code == PCAPNG_IF_TSRESOL && value >= 1) {
+			/* negative power of 10 or, with the MSB set, of 2 */
+			byte_t resolution = body[ offset + 4 ];
+			byte_t exponent   = resolution & 0x7f;
+			if (resolution & 0x80) {
+				if (exponent > 63)
+					return invalid(state);
+				interface->units = UINT64_C(1) << exponent;
+			}
+			else {
+				if (exponent > 19)
+					return invalid(state);
+				for (interface->units = 1; exponent > 0;
+					exponent--)
+					interface->units *= 10;
+			}
+		}
+		offset += 4 + PAD4(value);
+	}
+	return NEXT_SKIP;
+}
+
+static int
+next_block(data_t *data, const byte_t *ptr, data_t *cursor,
+	capture_state_t *state, capture_packet_t *packet)
+{
+	size_t position  = state->position;
+	size_t remaining = data->length - position;
+	if (remaining < PCAPNG_BLOCK_MIN)
+		return NEXT_END;
+
+	const byte_t *block = ptr + position;
+	uint32_t type = get32(block, state->swapped);
+	if (type == PCAPNG_SHB && next_section(state, block, remaining) ==
+		NEXT_END)
+		return NEXT_END;
+
+	bool swapped = state->swapped;
+	uint32_t length = get32(block + 4, swapped);
+	if (length < PCAPNG_BLOCK_MIN || length % 4 != 0)
+		return invalid(state);
+
+	/* a truncated block ends the iteration, as if not written yet */
+	if (length > remaining)
+		return NEXT_END;
+
+	state->position = position + length;
+
+	const byte_t *body = block + 8;
+	size_t   body_length = length - PCAPNG_BLOCK_MIN;
+	size_t   offset;
+	uint32_t interface_id;
+	uint32_t captured;
+	uint64_t timestamp = 0;
+
+	switch (type) {
+	case PCAPNG_IDB:
+		return next_interface(state, body, body_length);
+	case PCAPNG_EPB:
+	case PCAPNG_PB:
+		if (body_length < 20)
+			return invalid(state);
+
+		interface_id   = type == PCAPNG_EPB ? get32(body, swapped) :
+			get16(body, swapped);
+		timestamp      = (uint64_t) get32(body + 4, swapped) << 32 |
+			get32(body + 8, swapped);
+		captured       = get32(body + 12, swapped);
+		packet->length = get32(body + 16, swapped);
+		offset = 20;
+		break;
+	case PCAPNG_SPB:
+		if (body_length < 4 || state->ninterfaces == 0)
+			return invalid(state);
+
+		/* simple packets have no timestamp */
+		interface_id   = 0;
+		packet->length = get32(body, swapped);
+		captured       = packet->length;
+		if (state->interfaces[ 0 ].snaplen > 0)
+			captured = MIN(captured,
+				state->interfaces[ 0 ].snaplen);
+		offset = 4;
+		break;
+	default:
+		return NEXT_SKIP;
+	}
+
+	if (interface_id >= state->ninterfaces ||
+	    captured > body_length - offset)
+		return invalid(state);
+
+	capture_interface_t *interface = &state->interfaces[ interface_id ];
+	packet->seconds     = timestamp / interface->units;
+	packet->nanoseconds = to_nanoseconds(timestamp % interface->units,
+		interface->units);
+	packet->linktype    = interface->linktype;
+
+	if (captured == 0)
+		return NEXT_SKIP;
+
+	return data_move_segment(cursor, data, (size_t) (body + offset - ptr),
+		captured) ? 1 : NEXT_END;
+}
+
+/*
+ * moves the cursor to the next packet of a capture file and returns 1, or
+ * returns 0 once there are no more packets or the file is invalid
+ */
+int
+capture_next(data_t *data, data_t *cursor, capture_state_t *state,
+	capture_packet_t *packet)
+{
+	const byte_t *ptr = (const byte_t *) data_get_ptr(data);
+	if (ptr == NULL || state->invalid)
+		return 0;
+
+	int next;
+	do {
+		next = state->ng ?
+			next_block(data, ptr, cursor, state, packet) :
+			next_record(data, ptr, cursor, state, packet);
+	} while (next == NEXT_SKIP);
+	return next;
+}
+
+void
+capture_close(lua_State *L, capture_t *capture)
+{
+	if (capture->handle != NULL) {
+		/* invalidate the data object of the file and its segments */
+		handle_unref(capture->handle);
+		handle_delete(L, capture->handle);
+		capture->handle = NULL;
+	}
+
+	if (capture->map != NULL) {
+		munmap(capture->map, capture->size);
+		capture->map = NULL;
+	}
+}
+
+static bool
+write_all(int fd, const byte_t *bytes, size_t length)
+{
+	while (length > 0) {
+		ssize_t n = write(fd, bytes, length);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+
+		bytes  += n;
+		length -= (size_t) n;
+	}
+	return true;
+}
+
+/*
+ * opens a pcap file for appending, writing its header if it is empty; an
+ * existing file must have the given link type
+ */
+capture_writer_t *
+capture_writer_open(lua_State *L, const char *path, uint32_t linktype)
+{
+	/* created first, so a memory error cannot leak the descriptor */
+	capture_writer_t *writer = (capture_writer_t *) lua_newuserdata(L,
+		sizeof(capture_writer_t));
+	writer->fd          = -1;
+	writer->swapped     = false;
+	writer->nanoseconds = true;
+	writer->used        = 0;
+	luau_setmetatable(L, CAPTURE_WRITER_USERDATA);
+
+	int fd = open(path, O_RDWR | O_CREAT | O_APPEND, 0644);
+	if (fd < 0)
+		goto fail;
+
+	byte_t   header[ PCAP_HEADER_SIZE ];
+	bool     swapped = false;
+	uint64_t units   = NSEC_PER_SEC;
+
+	ssize_t n = pread(fd, header, sizeof(header), 0);
+	if (n == 0) {
+		set32(header, PCAP_MAGIC_NSEC, false);
+		set16(header + 4, 2, false);	/* version */
+		set16(header + 6, 4, false);
+		set32(header + 8, 0, false);	/* reserved */
+		set32(header + 12, 0, false);
+		set32(header + 16, PCAP_SNAPLEN, false);
+		set32(header + 20, linktype, false);
+		if (!write_all(fd, header, sizeof(header))) {
+			close(fd);
+			goto fail;
+		}
+	}
+	else if (n != sizeof(header) ||
+	    !pcap_magic(get32(header, false), &swapped, &units) ||
+	    get32(header + 20, swapped) != linktype) {
+		close(fd);
+		goto fail;
+	}
+
+	writer->fd          = fd;
+	writer->swapped     = swapped;
+	writer->nanoseconds = units == NSEC_PER_SEC;
+	return writer;
+fail:
+	lua_pop(L, 1);
+	return NULL;
+}
+
+bool
+capture_flush(capture_writer_t *writer)
+{
+	if (writer->fd < 0)
+		return false;
+
+	/* a failed write drops the buffered records */
+	bool written = write_all(writer->fd, writer->buffer, writer->used);
+	writer->used = 0;
+	return written;
+}
+
+void
+capture_timestamp(capture_packet_t *packet)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	packet->seconds     = (uint64_t) now.tv_sec;
+	packet->nanoseconds = (uint32_t) now.tv_nsec;
+}
+
+/* appends a record; records larger than the buffer are written directly */
+bool
+capture_write(capture_writer_t *writer, const byte_t *bytes, size_t length,
+	capture_packet_t *packet)
+{
+	if (writer->fd < 0 || length > UINT32_MAX)
+		return false;
+
+	byte_t record[ PCAP_RECORD_SIZE ];
+	bool   swapped = writer->swapped;
+	set32(record, (uint32_t) packet->seconds, swapped);
+	set32(record + 4, writer->nanoseconds ? packet->nanoseconds :
+		packet->nanoseconds / 1000, swapped);
+	set32(record + 8, (uint32_t) length, swapped);
+	set32(record + 12, packet->length, swapped);
+
+	size_t size = PCAP_RECORD_SIZE + length;
+	if (size > CAPTURE_BUFFER_SIZE - writer->used &&
+	    !capture_flush(writer))
+		return false;
+
+	if (size > CAPTURE_BUFFER_SIZE)
+		return write_all(writer->fd, record, sizeof(record)) &&
+			write_all(writer->fd, bytes, length);
+
+	memcpy(writer->buffer + writer->used, record, sizeof(record));
+	memcpy(writer->buffer + writer->used + sizeof(record), bytes, length);
+	writer->used += size;
+	return true;
+}
+
+void
+capture_writer_close(capture_writer_t *writer)
+{
+	if (writer->fd < 0)
+		return;
+
+	capture_flush(writer);
+	close(writer->fd);
+	writer->fd = -1;
+}
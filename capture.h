@@ -0,0 +1,106 @@
+/*
+ * Copyright (c) 2014, Lourival Vieira Neto <lneto@NetBSD.org>.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the Author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#ifndef _CAPTURE_H_
+#define _CAPTURE_H_
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <lua.h>
+
+#include "handle.h"
+#include "data.h"
+
+#define CAPTURE_USERDATA	"data.pcap"
+#define CAPTURE_WRITER_USERDATA	"data.pcap_writer"
+
+#define CAPTURE_MAX_INTERFACES	(32)
+#define CAPTURE_BUFFER_SIZE	(64 * 1024)
+
+#define CAPTURE_LINKTYPE_ETHERNET	(1)
+
+/* capture file (pcap or pcapng) mapped in memory */
+typedef struct {
+	byte_t   *map;
+	size_t    size;
+	handle_t *handle;	/* of the mapping, referred by packet segments */
+	bool      ng;
+} capture_t;
+
+typedef struct {
+	uint16_t linktype;
+	uint32_t snaplen;
+	uint64_t units;		/* of timestamps, per second */
+} capture_interface_t;
+
+/* state of an iteration over the packets of a capture file */
+typedef struct {
+	size_t              position;	/* of the next record or block */
+	bool                ng;
+	bool                swapped;	/* byte order of the current section */
+	bool                invalid;
+	size_t              ninterfaces;
+	capture_interface_t interfaces[ CAPTURE_MAX_INTERFACES ];
+} capture_state_t;
+
+typedef struct {
+	uint64_t seconds;
+	uint32_t nanoseconds;
+	uint32_t length;	/* on the wire; the segment has the captured one */
+	uint16_t linktype;
+} capture_packet_t;
+
+typedef struct {
+	int    fd;
+	bool   swapped;
+	bool   nanoseconds;
+	size_t used;
+	byte_t buffer[ CAPTURE_BUFFER_SIZE ];
+} capture_writer_t;
+
+capture_t * capture_open(lua_State *, const char *);
+
+void capture_init(capture_t *, capture_state_t *);
+
+int capture_next(data_t *, data_t *, capture_state_t *, capture_packet_t *);
+
+void capture_close(lua_State *, capture_t *);
+
+capture_writer_t * capture_writer_open(lua_State *, const char *, uint32_t);
+
+void capture_timestamp(capture_packet_t *);
+
+bool capture_write(capture_writer_t *, const byte_t *, size_t,
+	capture_packet_t *);
+
+bool capture_flush(capture_writer_t *);
+
+void capture_writer_close(capture_writer_t *);
+
+#endif /* _CAPTURE_H_ */
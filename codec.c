@@ -0,0 +1,303 @@
+/*
+ * Copyright (c) 2014, Lourival Vieira Neto <lneto@NetBSD.org>.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the Author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#ifndef _KERNEL
+#include <limits.h>
+#include <sys/param.h>
+#else
+#if defined(__NetBSD__)
+#include <machine/limits.h>
+#include <sys/param.h>
+#elif defined(__linux__)
+#include <linux/kernel.h>
+#endif
+#endif
+
+#include <lauxlib.h>
+
+#include "codec.h"
+
+/* SSE2 is baseline on x86-64; SSSE3 is checked at run time */
+#if !defined(_KERNEL) && defined(__x86_64__) && defined(__GNUC__)
+#define CODEC_SIMD
+#include <immintrin.h>
+#endif
+
+static const char hex_digits[ ] = "0123456789abcdef";
+
+static const char base64_digits[ ] =
+	"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+#define BASE64_PAD	'='
+
+/* digit values plus 1; 0 stands for an invalid digit */
+static const byte_t hex_values[ UCHAR_MAX + 1 ] = {
+	['0'] = 1, ['1'] = 2, ['2'] = 3, ['3'] = 4, ['4'] = 5,
+	['5'] = 6, ['6'] = 7, ['7'] = 8, ['8'] = 9, ['9'] = 10,
+	['a'] = 11, ['b'] = 12, ['c'] = 13, ['d'] = 14, ['e'] = 15, ['f'] = 16,
+	['A'] = 11, ['B'] = 12, ['C'] = 13, ['D'] = 14, ['E'] = 15, ['F'] = 16
+};
+
+/* digit values plus 1, as hex_values */
+static const byte_t base64_values[ UCHAR_MAX + 1 ] = {
+	['A'] = 1, ['B'] = 2, ['C'] = 3, ['D'] = 4, ['E'] = 5, ['F'] = 6,
+	['G'] = 7, ['H'] = 8, ['I'] = 9, ['J'] = 10, ['K'] = 11, ['L'] = 12,
+	['M'] = 13, ['N'] = 14, ['O'] = 15, ['P'] = 16, ['Q'] = 17, ['R'] = 18,
+	['S'] = 19, ['T'] = 20, ['U'] = 21, ['V'] = 22, ['W'] = 23, ['X'] = 24,
+	['Y'] = 25, ['Z'] = 26, ['a'] = 27, ['b'] = 28, ['c'] = 29, ['d'] = 30,
+	['e'] = 31, ['f'] = 32, ['g'] = 33, ['h'] = 34, ['i'] = 35, ['j'] = 36,
+	['k'] = 37, ['l'] = 38, ['m'] = 39, ['n'] = 40, ['o'] = 41, ['p'] = 42,
+	['q'] = 43, ['r'] = 44, ['s'] = 45, ['t'] = 46, ['u'] = 47, ['v'] = 48,
+	['w'] = 49, ['x'] = 50, ['y'] = 51, ['z'] = 52, ['0'] = 53, ['1'] = 54,
+	['2'] = 55, ['3'] = 56, ['4'] = 57, ['5'] = 58, ['6'] = 59, ['7'] = 60,
+	['8'] = 61, ['9'] = 62, ['+'] = 63, ['/'] = 64
+};
+
+#ifdef CODEC_SIMD
+/* encodes 16 bytes per iteration; returns how many bytes were encoded */
+static size_t
+hex_encode_sse2(char *dst, const byte_t *src, size_t len)
+{
+	const __m128i mask   = _mm_set1_epi8(0x0f);
+	const __m128i nine   = _mm_set1_epi8(9);
+	const __m128i digit  = _mm_set1_epi8('0');
+	const __m128i letter = _mm_set1_epi8('a' - '0' - 10);
+
+	size_t i = 0;
+	for (; i + 16 <= len; i += 16) {
+		__m128i in = _mm_loadu_si128((const __m128i *) (src + i));
+		__m128i hi = _mm_and_si128(_mm_srli_epi16(in, 4), mask);
+		__m128i lo = _mm_and_si128(in, mask);
+
+		hi = _mm_add_epi8(_mm_add_epi8(hi, digit),
+			_mm_and_si128(_mm_cmpgt_epi8(hi, nine), letter));
+		lo = _mm_add_epi8(_mm_add_epi8(lo, digit),
+			_mm_and_si128(_mm_cmpgt_epi8(lo, nine), letter));
+
+		_mm_storeu_si128((__m128i *) (dst + i * 2),
+			_mm_unpacklo_epi8(hi, lo));
+		_mm_storeu_si128((__m128i *) (dst + i * 2 + 16),
+			_mm_unpackhi_epi8(hi, lo));
+	}
+	return i;
+}
+
+/*
+ * encodes 12 bytes per iteration, loading 16 of them; the 6-bit indexes are
+ * unpacked with multiplies and mapped to digits by adding per-range offsets
+ * looked up with a shuffle; returns how many bytes were encoded
+ */
+__attribute__((target("ssse3")))
+static size_t
+base64_encode_ssse3(char *dst, const byte_t *src, size_t len)
+{
+	const __m128i spread = _mm_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4,
+		7, 6, 8, 7, 10, 9, 11, 10);
+	const __m128i offsets = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52,
+		'0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+		'0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+
+	size_t i = 0;
+	for (; i + 16 <= len; i += 12, dst += 16) {
+		__m128i in = _mm_shuffle_epi8(
+			_mm_loadu_si128((const __m128i *) (src + i)), spread);
+
+		__m128i ac = _mm_mulhi_epu16(_mm_and_si128(in,
+			_mm_set1_epi32(0x0fc0fc00)), _mm_set1_epi32(0x04000040));
+		__m128i bd = _mm_mullo_epi16(_mm_and_si128(in,
+			_mm_set1_epi32(0x003f03f0)), _mm_set1_epi32(0x01000010));
+		__m128i indexes = _mm_or_si128(ac, bd);
+
+		/* ranges: 0 for 'a'-'z', 1-10 for digits, 11 '+', 12 '/', 13 'A'-'Z' */
+		__m128i range = _mm_subs_epu8(indexes, _mm_set1_epi8(51));
+		__m128i upper = _mm_cmpgt_epi8(_mm_set1_epi8(26), indexes);
+		range = _mm_or_si128(range, _mm_and_si128(upper,
+			_mm_set1_epi8(13)));
+
+		_mm_storeu_si128((__m128i *) dst, _mm_add_epi8(indexes,
+			_mm_shuffle_epi8(offsets, range)));
+	}
+	return i;
+}
+#endif
+
+size_t
+codec_hex_encode(char *dst, const byte_t *src, size_t len)
+{
+	size_t i = 0;
+
+#ifdef CODEC_SIMD
+	i = hex_encode_sse2(dst, src, len);
+#endif
+	for (; i < len; i++) {
+		dst[ i * 2 ]     = hex_digits[ src[ i ] >> 4 ];
+		dst[ i * 2 + 1 ] = hex_digits[ src[ i ] & 0x0f ];
+	}
+	return CODEC_HEX_SIZE(len);
+}
+
+/* decodes len / 2 bytes; false if len is odd or there is an invalid digit */
+bool
+codec_hex_decode(byte_t *dst, const char *src, size_t len)
+{
+	if (len % 2 != 0)
+		return false;
+
+	for (size_t i = 0; i < len; i += 2) {
+		byte_t hi = hex_values[ (byte_t) src[ i ] ];
+		byte_t lo = hex_values[ (byte_t) src[ i + 1 ] ];
+		if (hi == 0 || lo == 0)
+			return false;
+
+		dst[ i / 2 ] = (hi - 1) << 4 | (lo - 1);
+	}
+	return true;
+}
+
+size_t
+codec_base64_encode(char *dst, const byte_t *src, size_t len)
+{
+	size_t i = 0;
+	char  *out = dst;
+
+#ifdef CODEC_SIMD
+	if (__builtin_cpu_supports("ssse3")) {
+		i = base64_encode_ssse3(out, src, len);
+		out += i / 3 * 4;
+	}
+#endif
+	for (; i + 3 <= len; i += 3, out += 4) {
+		uint32_t bits = src[ i ] << 16 | src[ i + 1 ] << 8 | src[ i + 2 ];
+
+		out[ 0 ] = base64_digits[ bits >> 18 ];
+		out[ 1 ] = base64_digits[ bits >> 12 & 0x3f ];
+		out[ 2 ] = base64_digits[ bits >> 6 & 0x3f ];
+		out[ 3 ] = base64_digits[ bits & 0x3f ];
+	}
+
+	if (i < len) {
+		uint32_t bits = src[ i ] << 16 |
+			(i + 1 < len ? src[ i + 1 ] << 8 : 0);
+
+		out[ 0 ] = base64_digits[ bits >> 18 ];
+		out[ 1 ] = base64_digits[ bits >> 12 & 0x3f ];
+		out[ 2 ] = i + 1 < len ? base64_digits[ bits >> 6 & 0x3f ] :
+			BASE64_PAD;
+		out[ 3 ] = BASE64_PAD;
+	}
+	return CODEC_BASE64_SIZE(len);
+}
+
+/* returns the decoded length of base64 digits, which may be padded */
+size_t
+codec_base64_length(const char *src, size_t len)
+{
+	if (len % 4 == 0 && len > 0 && src[ len - 1 ] == BASE64_PAD)
+		len -= src[ len - 2 ] == BASE64_PAD ? 2 : 1;
+
+	if (len % 4 == 1)
+		return 0;
+
+	return len / 4 * 3 + (len % 4 == 0 ? 0 : len % 4 - 1);
+}
+
+/*
+ * decodes codec_base64_length() bytes; false if there is an invalid digit,
+ * including padding anywhere but at the end
+ */
+bool
+codec_base64_decode(byte_t *dst, const char *src, size_t len)
+{
+	size_t length = codec_base64_length(src, len);
+	size_t digits = CEIL_DIV(length * 4, 3);
+
+	uint32_t bits = 0;
+	for (size_t i = 0; i < digits; i++) {
+		byte_t value = base64_values[ (byte_t) src[ i ] ];
+		if (value == 0)
+			return false;
+
+		bits = bits << 6 | (value - 1);
+		if (i % 4 == 3) {
+			dst[ 0 ] = bits >> 16;
+			dst[ 1 ] = bits >> 8;
+			dst[ 2 ] = bits;
+			dst += 3;
+		}
+	}
+
+	/* trailing digits, whose unused bits must be zero */
+	switch (digits % 4) {
+	case 2:
+		if (bits & 0x0f)
+			return false;
+		dst[ 0 ] = bits >> 4;
+		break;
+	case 3:
+		if (bits & 0x03)
+			return false;
+		dst[ 0 ] = bits >> 10;
+		dst[ 1 ] = bits >> 2;
+		break;
+	}
+	return true;
+}
+
+static size_t
+encode(codec_t codec, char *dst, const byte_t *src, size_t len)
+{
+	return codec == CODEC_HEX ? codec_hex_encode(dst, src, len) :
+		codec_base64_encode(dst, src, len);
+}
+
+/* pushes the encoding of len bytes as a string */
+void
+codec_push(lua_State *L, codec_t codec, const byte_t *src, size_t len)
+{
+	luaL_Buffer b;
+
+#if LUA_VERSION_NUM >= 502
+	size_t size = codec == CODEC_HEX ? CODEC_HEX_SIZE(len) :
+		CODEC_BASE64_SIZE(len);
+
+	char *dst = luaL_buffinitsize(L, &b, size);
+	luaL_pushresultsize(&b, encode(codec, dst, src, len));
+#else
+	/* input bytes whose encoding fits in the buffer, at once */
+	size_t chunk = codec == CODEC_HEX ? LUAL_BUFFERSIZE / 2 :
+		LUAL_BUFFERSIZE / 4 * 3;
+
+	luaL_buffinit(L, &b);
+	while (len > 0) {
+		size_t n = MIN(len, chunk);
+		luaL_addsize(&b, encode(codec, luaL_prepbuffer(&b), src, n));
+		src += n;
+		len -= n;
+	}
+	luaL_pushresult(&b);
+#endif
+}
@@ -0,0 +1,60 @@
+/*
+ * Copyright (c) 2014, Lourival Vieira Neto <lneto@NetBSD.org>.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the Author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#ifndef _CODEC_H_
+#define _CODEC_H_
+
+#ifndef _KERNEL
+#include <stddef.h>
+#include <stdbool.h>
+#endif
+
+#include <lua.h>
+
+#include "binary.h"
+
+typedef enum {
+	CODEC_HEX = 0,
+	CODEC_BASE64
+} codec_t;
+
+#define CODEC_HEX_SIZE(len)	((len) * 2)
+#define CODEC_BASE64_SIZE(len)	(CEIL_DIV((len), 3) * 4)
+
+size_t codec_hex_encode(char *, const byte_t *, size_t);
+
+bool codec_hex_decode(byte_t *, const char *, size_t);
+
+size_t codec_base64_encode(char *, const byte_t *, size_t);
+
+size_t codec_base64_length(const char *, size_t);
+
+bool codec_base64_decode(byte_t *, const char *, size_t);
+
+void codec_push(lua_State *, codec_t, const byte_t *, size_t);
+
+#endif /* _CODEC_H_ */
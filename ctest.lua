@@ -1,4 +1,9 @@
 function filter(d)
+	-- reused data objects come with no layout applied
+	if d.uint16 ~= nil then
+		return nil
+	end
+
 	-- store d in a global
 	gd = d
 	d:layout{
@@ -19,4 +24,111 @@ function access_global()
 	return gd.uint16
 end
 
+function arena_new()
+	-- store a data object allocated in the arena in a global
+	ad = arena:new{0xab}
+	ad:layout{byte = {0, 8}}
+	return ad.byte == 0xab
+end
+
+function access_arena()
+	-- should return nil if ldata_resetarena() has been called from C
+	return ad.byte
+end
+
+function decoded(layers)
+	-- the Ethernet padding is not taken as payload
+	return layers.payload == nil and layers.ipv4.ttl == 64 and
+		layers.udp.dport
+end
+
+records = 0
+
+function consume()
+	-- dequeue a batch of records produced by test.c
+	local batch = {ring:dequeue(16)}
+	for i = 1, #batch do
+		local d = batch[i]
+		d:layout{first = {0, 8}, last = {(#d - 1) * 8, 8}}
+		if #d ~= 1 + records % 8 or d.first ~= records % 256 or
+			d.last ~= records % 256 then
+			return nil
+		end
+		records = records + 1
+	end
+	return #batch
+end
+
+function transfer(rfd, wfd, fd)
+	-- the base library is not open; counts failed checks instead
+	local failures = 0
+	local function check(ok)
+		if not ok then failures = failures + 1 end
+	end
+
+	-- write a range to a pipe and read it back into a data object
+	local d, r = data.new'abcdef', data.new(3)
+	check(d:write_to(wfd, 1, 3) == 3)
+	check(r:read_from(rfd) == 3 and r:tostring() == 'bcd')
+
+	-- scatter and gather data objects and segments
+	local a, b, x = data.new'12', data.new'345', data.new(8)
+	check(data.writev(wfd, {a, b}) == 5)
+	check(data.readv(rfd, {x:segment(0, 1), x:segment(4, 4)}) == 5)
+	check(x:tostring() == '1\0\0\0' .. '2345')
+
+	-- transfer at file positions, which leave the file offset alone
+	check(d:write_to(fd, nil, nil, 10) == 6)
+	check(r:read_from(fd, 0, 3, 12) == 3 and r:tostring() == 'cde')
+	check(data.writev(fd, {a, b}, 0) == 5)
+	check(data.readv(fd, {x}, 0) == 8 and x:tostring() == '12345\0\0\0')
+	check(r:read_from(fd) == 3 and r:tostring() == '123')
+
+	-- batches are submitted at once, with io_uring or one call each
+	for i = 1, 2 do
+		local uring = i == 1
+		local batch = data.batch(3, uring)
+		check(uring or not batch:uring())
+
+		local y, z = data.new(2), data.new(4)
+		check(batch:write(fd, data.new'xy', 20):read(fd, y, 11))
+		check(batch:read(fd, z, 0) == batch)
+		check(batch:read(fd, d) == nil)
+
+		local results = batch:submit()
+		check(#results == 3 and results[1] == 2 and results[2] == 2)
+		check(results[3] == 4)
+		check(y:tostring() == 'bc' and z:tostring() == '1234')
+
+		-- the batch is reused once submitted
+		check(batch:read(fd, y, 20))
+		results = batch:submit()
+		check(#results == 1 and results[1] == 2)
+		check(y:tostring() == 'xy')
+
+		-- data released after being queued fails with EINVAL
+		local arena = data.arena(256)
+		check(batch:write(fd, arena:new'ab', 30):write(fd, a, 32))
+		arena:reset()
+		results = batch:submit()
+		check(#results == 2 and results[1] == -22 and results[2] == 2)
+
+		-- failures are negative errno values
+		check(batch:write(rfd, a))
+		check(batch:submit()[1] < 0)
+		check(#batch:submit() == 0)
+	end
+
+	-- check invalid transfers
+	check(r:read_from() == nil)
+	check(r:read_from(rfd, 2, 2) == nil)
+	check(data.readv(rfd, {}) == nil)
+	check(data.readv(rfd, {r, 'x'}) == nil)
+	check(data.batch(0) == nil)
+	local none, errno = r:write_to(rfd)
+	check(none == nil and errno > 0)
+
+	return failures == 0
+end
+
 d = data.new{0xff, 0xee, 0xdd, 0x00}
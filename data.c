@@ -42,6 +42,8 @@
 #include "data.h"
 #include "binary.h"
 #include "layout.h"
+#include "probes.h"
+#include "codec.h"
 
 #define LUA_INTEGER_BYTE	(sizeof(lua_Integer))
 #define LUA_INTEGER_BIT		(LUA_INTEGER_BYTE * BYTE_BIT)
@@ -56,7 +58,8 @@ check_offset(data_t *data, size_t offset, size_t length)
 inline static bool
 check_length(data_t *data, size_t offset, size_t length)
 {
-	return offset + length <= data->offset + data->length;
+	/* assertion: offset is within data bounds */
+	return length <= data->offset + data->length - offset;
 }
 
 inline static bool
@@ -66,34 +69,165 @@ check_limits(data_t *data, size_t offset, size_t length)
 		check_length(data, offset, length);
 }
 
+inline static bool
+check_range(data_t *data, size_t offset, size_t length)
+{
+	return check_limits(data, data->offset + offset, length);
+}
+
+/* data allocated in an arena is gone (along with its handle) on reset */
+inline static bool
+check_handle(data_t *data)
+{
+	return data->arena == NULL ||
+		data->generation == data->arena->generation;
+}
+
+/* gives a copy-on-write data object its own copy of the raw data */
+static bool
+unshare_data(lua_State *L, data_t *data)
+{
+	void *ptr = data_get_ptr(data);
+	if (ptr == NULL)
+		return false;
+
+	void *copy = handle_alloc(L, data->length);
+	if (copy == NULL)
+		return false;
+
+	memcpy(copy, ptr, data->length);
+
+	handle_t *handle = handle_new_single(L, copy, data->length, true);
+	if (handle == NULL) {
+		luau_free(L, copy, ALLOC_SIZE(data->length));
+		return false;
+	}
+
+	if (data->arena != NULL)
+		arena_delete(L, data->arena);
+	else
+		handle_delete(L, data->handle);
+
+	data->handle = handle;
+	data->offset = 0;
+	data->arena  = NULL;
+	data->cow    = false;
+	STATS_INC(data->stats, copies);
+	return true;
+}
+
+inline static bool
+check_writable(lua_State *L, data_t *data)
+{
+	if (!check_handle(data))
+		return false;
+
+	if (data->cow)
+		return unshare_data(L, data);
+
+	return HANDLE_WRITABLE(data->handle);
+}
+
+/*
+ * the extent of a layout only vouches for its own entries; entries of other
+ * layouts have their bounds checked one by one
+ */
+#define ENTRY_IN_BOUNDS(data, entry) \
+	((data)->in_bounds && (entry)->layout == (data)->compiled)
+
+#define ENTRY_WORD_IN_BOUNDS(data, entry) \
+	((data)->words_in_bounds && (entry)->layout == (data)->compiled)
+
 #define ENTRY_BYTE_OFFSET(data, entry) \
 	((BIT_TO_BYTE(entry->offset + 1) - 1) + data->offset)
 
 inline static bool
-check_num_limits(data_t *data, layout_entry_t *entry)
+check_bits_limits(data_t *data, layout_entry_t *entry)
 {
+	if (ENTRY_IN_BOUNDS(data, entry))
+		return true;
+
 	size_t offset = ENTRY_BYTE_OFFSET(data, entry);
-	size_t length = BIT_TO_BYTE(entry->length);
+	size_t length = BIT_TO_BYTE(entry->offset % BYTE_BIT + entry->length);
+
+	return check_limits(data, offset, length);
+}
 
+inline static bool
+check_num_limits(data_t *data, layout_entry_t *entry)
+{
 	return entry->length <= LUA_INTEGER_BIT &&
-		check_limits(data, offset, length);
+		check_bits_limits(data, entry);
+}
+
+/* whether a fused entry can be extracted from the whole word holding it */
+inline static bool
+check_word_limits(data_t *data, layout_entry_t *entry)
+{
+	return entry->fused && (ENTRY_WORD_IN_BOUNDS(data, entry) ||
+		check_limits(data, data->offset + entry->word, BINARY_WORD_BYTE));
 }
 
 inline static bool
 check_str_limits(data_t *data, layout_entry_t *entry)
 {
+	if (ENTRY_IN_BOUNDS(data, entry))
+		return true;
+
 	size_t offset = entry->offset + data->offset;
 	size_t length = entry->length;
 	return check_limits(data, offset, length);
 }
 
+/*
+ * fields of a layout whose extent lies within the data bounds are accessed
+ * without checking them one by one
+ */
+inline static void
+bind_extent(data_t *data)
+{
+	layout_t *layout = data->compiled;
+
+	data->in_bounds = layout != NULL && data->length >= layout->extent;
+	data->words_in_bounds = layout != NULL &&
+		data->length >= layout->word_extent;
+}
+
+/* a copy of a data object, with the extent of another layout bound */
+inline static void
+bind_view(data_t *view, data_t *data, layout_t *layout)
+{
+	*view = *data;
+	view->compiled = layout;
+	bind_extent(view);
+}
+
+/*
+ * the fields of the layout applied to a data object are held as its user
+ * value; they hold nothing but entries, thus are read unchecked
+ */
 inline static layout_entry_t *
-get_entry(lua_State *L, data_t *data, int key_ix)
+get_entry(lua_State *L, data_t *data, int data_ix, int key_ix)
 {
-	if (!luau_isvalidref(data->layout))
+	if (data->compiled == NULL)
 		return NULL;
 
-	return layout_get_entry(L, data->layout, key_ix);
+	luau_getuservalue(L, data_ix);
+	lua_pushvalue(L, key_ix);
+	lua_rawget(L, -2);
+	layout_entry_t *entry = (layout_entry_t *) lua_touserdata(L, -1);
+	lua_pop(L, 2);
+
+	/* assertion: the entry is anchored by the layout of the data */
+	return entry;
+}
+
+/* names a field for probes, without converting numeric keys in place */
+inline static const char *
+probe_key(lua_State *L, int key_ix)
+{
+	return lua_type(L, key_ix) == LUA_TSTRING ?
+		lua_tostring(L, key_ix) : NULL;
 }
 
 static data_t *
@@ -104,7 +238,18 @@ new_data(lua_State *L, handle_t *handle, size_t offset, size_t length)
 	data->handle = handle;
 	data->offset = offset;
 	data->length = length;
-	data->layout = LUA_REFNIL;
+	data->arena  = NULL;
+	data->generation = 0;
+	data->cow    = false;
+	data->compiled        = NULL;
+	data->in_bounds       = false;
+	data->words_in_bounds = false;
+#ifdef DATA_STATS
+	data->stats   = handle->stats;
+	data->segment = false;
+#endif
+	STATS_INC(data->stats, data);
+	STATS_INC(data->stats, allocs);
 
 	luau_setmetatable(L, DATA_USERDATA);
 
@@ -117,15 +262,25 @@ new_data(lua_State *L, handle_t *handle, size_t offset, size_t length)
 inline static int
 get_num(lua_State *L, data_t *data, layout_entry_t *entry)
 {
-	if (!check_num_limits(data, entry))
+	STATS_INC(data->stats, number_reads);
+	if (!check_num_limits(data, entry)) {
+		STATS_INC(data->stats, misses);
 		return 0;
+	}
 
 	byte_t *ptr = (byte_t *) data_get_ptr(data);
 	if (ptr == NULL)
 		return 0;
 
 	/* assertion: LUA_INTEGER_BIT <= 64 */
-	lua_Integer value = binary_get_uint64(BINARY_PARMS(data, entry, ptr));
+	lua_Integer value;
+	if (check_word_limits(data, entry)) {
+		uint64_t word = binary_get_word(ptr + entry->word);
+		value = BINARY_EXTRACT(word, entry->shift, entry->length);
+	}
+	else
+		value = binary_get_uint64(BINARY_PARMS(data, entry, ptr));
+
 	lua_pushinteger(L, value);
 	return 1;
 }
@@ -133,8 +288,11 @@ get_num(lua_State *L, data_t *data, layout_entry_t *entry)
 inline static int
 get_str(lua_State *L, data_t *data, layout_entry_t *entry)
 {
-	if (!check_str_limits(data, entry))
+	STATS_INC(data->stats, string_reads);
+	if (!check_str_limits(data, entry)) {
+		STATS_INC(data->stats, misses);
 		return 0;
+	}
 
 	const char *ptr = (const char *) data_get_ptr(data); 
 	const char *s = ptr + entry->offset;
@@ -145,8 +303,11 @@ get_str(lua_State *L, data_t *data, layout_entry_t *entry)
 inline static void
 set_num(lua_State *L, data_t *data, layout_entry_t *entry, int value_ix)
 {
-	if (!check_num_limits(data, entry))
+	STATS_INC(data->stats, number_writes);
+	if (!check_num_limits(data, entry)) {
+		STATS_INC(data->stats, misses);
 		return;
+	}
 
 	byte_t *ptr = (byte_t *) data_get_ptr(data);
 	if (ptr == NULL)
@@ -160,8 +321,11 @@ set_num(lua_State *L, data_t *data, layout_entry_t *entry, int value_ix)
 static void
 set_str(lua_State *L, data_t *data, layout_entry_t *entry, int value_ix)
 {
-	if (!check_str_limits(data, entry))
+	STATS_INC(data->stats, string_writes);
+	if (!check_str_limits(data, entry)) {
+		STATS_INC(data->stats, misses);
 		return;
+	}
 
 	size_t len;
 	const char *s = lua_tolstring(L, value_ix, &len);
@@ -172,9 +336,139 @@ set_str(lua_State *L, data_t *data, layout_entry_t *entry, int value_ix)
 	memcpy(ptr + entry->offset, s, MIN(len, entry->length));
 }
 
+/* bytes a varint entry may span, up to its length and the data bounds */
+inline static size_t
+varint_limit(data_t *data, layout_entry_t *entry)
+{
+	if (ENTRY_IN_BOUNDS(data, entry))
+		return entry->length;
+
+	if (!check_range(data, entry->offset, 1))
+		return 0;
+
+	return MIN(entry->length, data->length - entry->offset);
+}
+
+static int
+get_varint(lua_State *L, data_t *data, layout_entry_t *entry)
+{
+	STATS_INC(data->stats, number_reads);
+
+	byte_t  *ptr  = (byte_t *) data_get_ptr(data);
+	size_t   size = varint_limit(data, entry);
+	uint64_t value;
+
+	if (ptr == NULL || size == 0 ||
+	    binary_get_varint(ptr + entry->offset, size, &value) == 0) {
+		STATS_INC(data->stats, misses);
+		return 0;
+	}
+
+	if (entry->type == LAYOUT_TZIGZAG)
+		lua_pushinteger(L, (lua_Integer) BINARY_ZIGZAG_DECODE(value));
+	else
+		lua_pushinteger(L, (lua_Integer) value);
+	return 1;
+}
+
+/* varints are written padded to the entry length, to keep it in place */
+static void
+set_varint(lua_State *L, data_t *data, layout_entry_t *entry, int value_ix)
+{
+	STATS_INC(data->stats, number_writes);
+	if (!check_str_limits(data, entry)) {
+		STATS_INC(data->stats, misses);
+		return;
+	}
+
+	lua_Integer value = lua_tointeger(L, value_ix);
+	uint64_t encoded = entry->type == LAYOUT_TZIGZAG ?
+		BINARY_ZIGZAG_ENCODE(value) : (uint64_t) value;
+
+	byte_t *ptr = (byte_t *) data_get_ptr(data);
+	if (ptr != NULL)
+		binary_set_varint(ptr + entry->offset, entry->length, encoded);
+}
+
+inline static int
+get_value(lua_State *L, data_t *data, layout_entry_t *entry)
+{
+	switch (entry->type) {
+	case LAYOUT_TNUMBER:
+		return get_num(L, data, entry);
+	case LAYOUT_TSTRING:
+		return get_str(L, data, entry);
+	case LAYOUT_TVARINT:
+	case LAYOUT_TZIGZAG:
+		return get_varint(L, data, entry);
+	}
+	return 0; /* unreached */
+}
+
+/* whether an entry lies within the data bounds, so it can be written */
+inline static bool
+check_entry_limits(data_t *data, layout_entry_t *entry)
+{
+	return entry->type == LAYOUT_TNUMBER ?
+		check_num_limits(data, entry) : check_str_limits(data, entry);
+}
+
+/*
+ * copy-on-write data is only unshared for writes within the bounds of a view
+ * of it; others are left to set_value(), which counts them as misses
+ */
+inline static bool
+check_entry_writable(lua_State *L, data_t *data, data_t *view,
+	layout_entry_t *entry)
+{
+	return !check_entry_limits(view, entry) || check_writable(L, data);
+}
+
+inline static void
+set_value(lua_State *L, data_t *data, layout_entry_t *entry, int value_ix)
+{
+	switch (entry->type) {
+	case LAYOUT_TNUMBER:
+		set_num(L, data, entry, value_ix);
+		break;
+	case LAYOUT_TSTRING:
+		set_str(L, data, entry, value_ix);
+		break;
+	case LAYOUT_TVARINT:
+	case LAYOUT_TZIGZAG:
+		set_varint(L, data, entry, value_ix);
+		break;
+	}
+}
+
+/* reads a type or length field of a TLV element; width 0 is a varint */
+static bool
+get_tlv_field(byte_t *ptr, size_t *position, size_t end, size_t width,
+	int endian, uint64_t *value)
+{
+	size_t available = end - *position;
+
+	if (width == 0) {
+		size_t size = binary_get_varint(ptr + *position, available,
+			value);
+		*position += size;
+		return size > 0;
+	}
+
+	if (width > available)
+		return false;
+
+	*value = binary_get_uint64(ptr + *position, 0, BYTE_TO_BIT(width),
+		endian);
+	*position += width;
+	return true;
+}
+
 inline data_t *
 data_new(lua_State *L, void *ptr, size_t size, bool free)
 {
+	DATA_PROBE3(data_new, ptr, size, free);
+
 	handle_t *handle = handle_new_single(L, ptr, size, free);
 	if (handle == NULL)
 		luaL_error(L, "not enough memory");
@@ -183,6 +477,74 @@ data_new(lua_State *L, void *ptr, size_t size, bool free)
 	return data;
 }
 
+data_t *
+data_new_arena(lua_State *L, arena_t *arena, void *ptr, size_t size)
+{
+	handle_t *handle = (handle_t *) arena_alloc(arena, sizeof(handle_t));
+	if (handle == NULL)
+		return NULL;
+
+	/* the arena owns both the handle and the raw data */
+	handle_init_single(handle, ptr, size, false);
+#ifdef DATA_STATS
+	handle->stats = arena->stats;
+#endif
+	arena->refcount++;
+
+	data_t *data = new_data(L, handle, 0, size);
+	data->arena      = arena;
+	data->generation = arena->generation;
+	return data;
+}
+
+/* points a data object created by ldata_newref() to another buffer */
+bool
+data_rebind(data_t *data, void *ptr, size_t size)
+{
+	handle_t *handle = data->handle;
+
+	/* segments would see the new buffer as well */
+	if (data->arena != NULL || handle->type != HANDLE_TYPE_SINGLE ||
+		handle->free || handle->refcount > 0)
+		return false;
+
+	single_t *single = &handle->bucket.single;
+	single->ptr  = ptr;
+	single->size = size;
+
+	/* fields of the previous buffer are not read from the new one */
+	data->offset   = 0;
+	data->length   = size;
+	data->compiled = NULL;
+	bind_extent(data);
+	return true;
+}
+
+#ifndef _KERNEL
+shared_token_t *
+data_export(lua_State *L, data_t *data)
+{
+	if (!check_handle(data) || data->arena != NULL)
+		return NULL;
+
+	shared_t *shared = handle_share(L, data->handle);
+	if (shared == NULL)
+		return NULL;
+
+	return shared_token_new(shared, data->offset, data->length);
+}
+
+data_t *
+data_import(lua_State *L, shared_token_t *token, bool writer)
+{
+	handle_t *handle = handle_new_shared(L, token->shared, writer);
+	if (handle == NULL)
+		return NULL;
+
+	return new_data(L, handle, token->offset, token->length);
+}
+#endif
+
 #if defined(_KERNEL) && defined(__NetBSD__)
 inline data_t *
 data_new_chain(lua_State *L, struct mbuf *chain, bool free)
@@ -199,86 +561,497 @@ data_new_chain(lua_State *L, struct mbuf *chain, bool free)
 int
 data_new_segment(lua_State *L, data_t *data, size_t offset, size_t length)
 {
-	if (!check_limits(data, offset, length))
+	if (!check_handle(data) || !check_limits(data, offset, length))
 		return 0;
 
 	handle_t *handle = data->handle;
 
-	handle->refcount++;
+	DATA_PROBE3(data_new_segment, handle, offset, length);
+
+	if (data->arena != NULL)
+		data->arena->refcount++;
+	else
+		handle->refcount++;
+
+	data_t *segment = new_data(L, handle, offset, length);
+	segment->arena      = data->arena;
+	segment->generation = data->generation;
+	segment->cow        = data->cow;
+#ifdef DATA_STATS
+	segment->stats   = data->stats;
+	segment->segment = true;
+	STATS_INC(data->stats, segments);
+#endif
+	return 1;
+}
+
+int
+data_new_cow_segment(lua_State *L, data_t *data, size_t offset, size_t length)
+{
+	if (data_new_segment(L, data, offset, length) == 0)
+		return 0;
 
-	new_data(L, handle, offset, length);
+	data_t *segment = (data_t *) lua_touserdata(L, -1);
+	segment->cow = true;
 	return 1;
 }
 
 inline void
 data_delete(lua_State *L, data_t *data)
 {
-	handle_delete(L, data->handle);
-
-	if (luau_isvalidref(data->layout))
-		luau_unref(L, data->layout);
+	STATS_DEC(data->stats, data);
+	STATS_INC(data->stats, frees);
+#ifdef DATA_STATS
+	if (data->segment)
+		STATS_DEC(data->stats, segments);
+#endif
+	if (data->arena != NULL)
+		arena_delete(L, data->arena);
+	else
+		handle_delete(L, data->handle);
 }
 
 inline data_t *
 data_test(lua_State *L, int index)
 {
-#if LUA_VERSION_NUM >= 502
-	return (data_t *) luaL_testudata(L, index, DATA_USERDATA);
-#else
-	return (data_t *) luaL_checkudata(L, index, DATA_USERDATA);
-#endif
+	return (data_t *) luau_testudata(L, index, DATA_USERDATA);
 }
 
-inline void
-data_apply_layout(lua_State *L, data_t *data, int layout_ix)
+/* returns false, leaving the data object as is, if it is not a layout */
+inline bool
+data_apply_layout(lua_State *L, int data_ix, int layout_ix)
 {
-	luau_unref(L, data->layout);
-	lua_pushvalue(L, layout_ix);
-	data->layout = luau_ref(L);
+	data_t *data = (data_t *) lua_touserdata(L, data_ix);
+
+	data_ix   = luau_absindex(L, data_ix);
+	layout_ix = luau_absindex(L, layout_ix);
+	layout_t *layout = layout_push_fields(L, layout_ix);
+	if (layout == NULL)
+		return false;
+
+	DATA_PROBE3(data_apply_layout, data, lua_topointer(L, layout_ix),
+		data->length);
+
+	luau_setuservalue(L, data_ix);
+	data->compiled = layout;
+	bind_extent(data);
+	return true;
 }
 
 int
-data_get_field(lua_State *L, data_t *data, int key_ix)
+data_get_field(lua_State *L, int data_ix, int key_ix)
 {
-	layout_entry_t *entry = get_entry(L, data, key_ix);
+	data_t *data = (data_t *) lua_touserdata(L, data_ix);
+	if (!check_handle(data))
+		return 0;
+
+	layout_entry_t *entry = get_entry(L, data, data_ix, key_ix);
 	if (entry == NULL)
 		return 0;
 
-	switch (entry->type) {
-	case LAYOUT_TNUMBER:
-		return get_num(L, data, entry);
-	case LAYOUT_TSTRING:
-		return get_str(L, data, entry);
+	if (DATA_PROBE_ENABLED(data_get_field))
+		DATA_PROBE4(data_get_field, probe_key(L, key_ix),
+			entry->offset, entry->length, entry->type);
+
+	return get_value(L, data, entry);
+}
+
+/*
+ * pushes the fields whose keys lie from first to last, or nil for the missing
+ * ones; consecutive fused fields sharing a word are extracted from a single
+ * load of it
+ */
+int
+data_unpack(lua_State *L, int data_ix, int first, int last)
+{
+	data_t *data = (data_t *) lua_touserdata(L, data_ix);
+	data_ix = luau_absindex(L, data_ix);
+	first   = luau_absindex(L, first);
+	last    = luau_absindex(L, last);
+
+	int n = last - first + 1;
+	if (n <= 0 || !check_handle(data) || !lua_checkstack(L, n))
+		return 0;
+
+	byte_t  *ptr = (byte_t *) data_get_ptr(data);
+	size_t   loaded = SIZE_MAX;
+	uint64_t word = 0;
+
+	for (int key_ix = first; key_ix <= last; key_ix++) {
+		layout_entry_t *entry = get_entry(L, data, data_ix, key_ix);
+		if (entry == NULL || ptr == NULL) {
+			lua_pushnil(L);
+			continue;
+		}
+
+		if (entry->length <= LUA_INTEGER_BIT &&
+		    check_word_limits(data, entry)) {
+			STATS_INC(data->stats, number_reads);
+			if (entry->word != loaded) {
+				word = binary_get_word(ptr + entry->word);
+				loaded = entry->word;
+			}
+			lua_pushinteger(L, (lua_Integer) BINARY_EXTRACT(word,
+				entry->shift, entry->length));
+			continue;
+		}
+
+		if (get_value(L, data, entry) == 0)
+			lua_pushnil(L);
 	}
-	return 0; /* unreached */
+	return n;
 }
 
 void
-data_set_field(lua_State *L, data_t *data, int key_ix, int value_ix)
+data_set_field(lua_State *L, int data_ix, int key_ix, int value_ix)
 {
-	layout_entry_t *entry = get_entry(L, data, key_ix);
-	if (entry == NULL)
+	data_t *data = (data_t *) lua_touserdata(L, data_ix);
+	if (!check_handle(data))
 		return;
 
-	switch (entry->type) {
-	case LAYOUT_TNUMBER:
-		set_num(L, data, entry, value_ix);
-		break;
-	case LAYOUT_TSTRING:
-		set_str(L, data, entry, value_ix);
-		break;
+	layout_entry_t *entry = get_entry(L, data, data_ix, key_ix);
+	if (entry == NULL || !check_entry_writable(L, data, data, entry))
+		return;
+
+	if (DATA_PROBE_ENABLED(data_set_field))
+		DATA_PROBE4(data_set_field, probe_key(L, key_ix),
+			entry->offset, entry->length, entry->type);
+
+	set_value(L, data, entry, value_ix);
+}
+
+/*
+ * accesses a field given its entry, regardless of the layout applied to the
+ * data object; the bounds of the data are checked against the layout holding
+ * that entry
+ */
+int
+data_get_entry(lua_State *L, data_t *data, layout_t *layout,
+	layout_entry_t *entry)
+{
+	if (!check_handle(data))
+		return 0;
+
+	if (data->compiled == layout)
+		return get_value(L, data, entry);
+
+	data_t view;
+	bind_view(&view, data, layout);
+	return get_value(L, &view, entry);
+}
+
+void
+data_set_entry(lua_State *L, data_t *data, layout_t *layout,
+	layout_entry_t *entry, int value_ix)
+{
+	if (!check_handle(data))
+		return;
+
+	if (data->compiled == layout) {
+		if (check_entry_writable(L, data, data, entry))
+			set_value(L, data, entry, value_ix);
+		return;
 	}
+
+	data_t view;
+	bind_view(&view, data, layout);
+	if (!check_entry_writable(L, data, &view, entry))
+		return;
+
+	/* unsharing moves the data to a copy of its own */
+	bind_view(&view, data, layout);
+	set_value(L, &view, entry, value_ix);
+}
+
+/*
+ * moves a cursor segment of data to the value of its next TLV element and
+ * pushes its type; the element must lie within the data bounds
+ */
+int
+data_tlv_next(lua_State *L, data_t *data, data_t *cursor, data_tlv_t *tlv)
+{
+	if (!check_handle(data) || cursor->handle != data->handle ||
+	    cursor->arena != data->arena || tlv->position >= data->length)
+		return 0;
+
+	byte_t *ptr = (byte_t *) data_get_ptr(data);
+	if (ptr == NULL)
+		return 0;
+
+	size_t   position = tlv->position;
+	uint64_t type, length;
+
+	if (!get_tlv_field(ptr, &position, data->length, tlv->type_width,
+		tlv->endian, &type) ||
+	    !get_tlv_field(ptr, &position, data->length, tlv->length_width,
+		tlv->endian, &length) ||
+	    length > data->length - position) {
+		tlv->position = data->length;
+		return 0;
+	}
+
+	cursor->offset = data->offset + position;
+	cursor->length = length;
+	bind_extent(cursor);
+
+	tlv->position = position + length;
+	lua_pushinteger(L, (lua_Integer) type);
+	return 1;
 }
 
 inline void *
 data_get_ptr(data_t *data)
 {
+	if (!check_handle(data))
+		return NULL;
+
 	return handle_get_ptr(data->handle, data->offset, data->length);
 }
 
+/* returns the bytes of a range, to be read or (if writable) written in place */
+void *
+data_get_range(lua_State *L, data_t *data, size_t offset, size_t length,
+	bool writable)
+{
+	if (!check_handle(data) || !check_range(data, offset, length) ||
+	    (writable && !check_writable(L, data)))
+		return NULL;
+
+	byte_t *ptr = (byte_t *) data_get_ptr(data);
+	if (ptr == NULL)
+		return NULL;
+
+	return ptr + offset;
+}
+
+int
+data_get_string(lua_State *L, data_t *data, size_t offset, size_t length,
+	bool shared)
+{
+	if (!check_handle(data) || !check_range(data, offset, length))
+		return 0;
+
+#if LUA_VERSION_NUM >= 505
+	if (shared && handle_pushstring(L, data->handle, data->offset + offset,
+			length))
+		return 1;
+#endif
+
+	const char *ptr = (const char *) data_get_ptr(data);
+	if (ptr == NULL)
+		return 0;
+
+	lua_pushlstring(L, ptr + offset, length);
+	return 1;
+}
+
+int
+data_encode(lua_State *L, data_t *data, size_t offset, size_t length,
+	codec_t codec)
+{
+	if (!check_handle(data) || !check_range(data, offset, length))
+		return 0;
+
+	const byte_t *ptr = (const byte_t *) data_get_ptr(data);
+	if (ptr == NULL)
+		return 0;
+
+	codec_push(L, codec, ptr + offset, length);
+	return 1;
+}
+
+bool
+data_copy(lua_State *L, data_t *dst, size_t dst_offset, data_t *src,
+	size_t src_offset, size_t length)
+{
+	if (!check_range(dst, dst_offset, length) ||
+	    !check_range(src, src_offset, length) || !check_writable(L, dst))
+		return false;
+
+	char *dst_ptr = (char *) data_get_ptr(dst);
+	char *src_ptr = (char *) data_get_ptr(src);
+	if (dst_ptr == NULL || src_ptr == NULL)
+		return false;
+
+	/* src and dst may overlap if they are segments of the same data */
+	memmove(dst_ptr + dst_offset, src_ptr + src_offset, length);
+	return true;
+}
+
+bool
+data_fill(lua_State *L, data_t *data, int byte, size_t offset, size_t length)
+{
+	if (!check_range(data, offset, length) || !check_writable(L, data))
+		return false;
+
+	char *ptr = (char *) data_get_ptr(data);
+	if (ptr == NULL)
+		return false;
+
+	memset(ptr + offset, byte, length);
+	return true;
+}
+
+int
+data_compare(data_t *data1, data_t *data2)
+{
+	const void *ptr1 = data_get_ptr(data1);
+	const void *ptr2 = data_get_ptr(data2);
+
+	/* unreferred data objects compare as empty */
+	size_t length1 = ptr1 != NULL ? data1->length : 0;
+	size_t length2 = ptr2 != NULL ? data2->length : 0;
+	size_t length  = MIN(length1, length2);
+
+	int result = length > 0 ? memcmp(ptr1, ptr2, length) : 0;
+	if (result != 0)
+		return result < 0 ? -1 : 1;
+
+	return (length1 > length2) - (length1 < length2);
+}
+
 inline void
 data_unref(data_t *data)
 {
+	if (!check_handle(data))
+		return;
+
 	handle_unref(data->handle);
 }
 
+/*
+ * moves a cursor segment of data to its next length-prefixed frame, which
+ * must be complete; a frame whose length exceeds the maximum invalidates
+ * the iteration
+ */
+int
+data_frame_next(data_t *data, data_t *cursor, data_frames_t *frames)
+{
+	if (frames->invalid || !check_handle(data) ||
+	    cursor->handle != data->handle || cursor->arena != data->arena)
+		return 0;
+
+	byte_t *ptr = (byte_t *) data_get_ptr(data);
+	size_t  start = frames->position;
+	if (ptr == NULL || start >= data->length ||
+	    frames->len_offset >= data->length - start ||
+	    frames->header_len > data->length - start)
+		return 0;
+
+	size_t   position = start + frames->len_offset;
+	uint64_t length;
+
+	if (!get_tlv_field(ptr, &position, data->length, frames->len_width,
+		frames->endian, &length)) {
+		/* a varint is malformed, rather than incomplete, past its size */
+		frames->invalid = frames->len_width == 0 &&
+			data->length - position >= BINARY_VARINT_MAX;
+		return 0;
+	}
+
+	if (length > frames->max_len) {
+		frames->invalid = true;
+		return 0;
+	}
+
+	size_t body = MAX(position, start + frames->header_len);
+	if (length > data->length - body)
+		return 0;
+
+	cursor->offset = data->offset + start;
+	cursor->length = body + length - start;
+	bind_extent(cursor);
+
+	frames->position = body + length;
+	return 1;
+}
+
+/*
+ * copies the bits of a field into bytes, MSB first and padded with zeros, and
+ * returns their width; numbers may be wider than Lua integers, as long as
+ * they are not multi-byte little-endian ones
+ */
+static size_t
+get_bits(data_t *data, layout_entry_t *entry, byte_t *bytes, size_t size)
+{
+	byte_t *ptr = (byte_t *) data_get_ptr(data);
+	if (ptr == NULL)
+		return 0;
+
+	if (entry->type == LAYOUT_TSTRING) {
+		if (entry->length > size || !check_str_limits(data, entry))
+			return 0;
+
+		memcpy(bytes, ptr + entry->offset, entry->length);
+		return BYTE_TO_BIT(entry->length);
+	}
+
+	if (entry->type != LAYOUT_TNUMBER ||
+	    BIT_TO_BYTE(entry->length) > size ||
+	    (entry->length > BYTE_BIT && entry->endian == LITTLE_ENDIAN) ||
+	    !check_bits_limits(data, entry))
+		return 0;
+
+	size_t length = BIT_TO_BYTE(entry->length);
+	size_t unused = BYTE_TO_BIT(length) - entry->length;
+
+	if (entry->offset % BYTE_BIT == 0) {
+		memcpy(bytes, ptr + entry->offset / BYTE_BIT, length);
+		bytes[ length - 1 ] &= (byte_t) (UCHAR_MAX << unused);
+		return entry->length;
+	}
+
+	for (size_t bit = 0; bit < entry->length; bit += BYTE_BIT) {
+		size_t width = MIN(BYTE_BIT, entry->length - bit);
+		byte_t byte  = (byte_t) binary_get_uint64(ptr,
+			entry->offset + bit, width, BIG_ENDIAN);
+
+		bytes[ bit / BYTE_BIT ] = byte << (BYTE_BIT - width);
+	}
+	return entry->length;
+}
+
+size_t
+data_get_bits(lua_State *L, int data_ix, int key_ix, byte_t *bytes,
+	size_t size)
+{
+	data_t *data = (data_t *) lua_touserdata(L, data_ix);
+	if (!check_handle(data))
+		return 0;
+
+	layout_entry_t *entry = get_entry(L, data, data_ix, key_ix);
+	if (entry == NULL)
+		return 0;
+
+	return get_bits(data, entry, bytes, size);
+}
+
+/* as data_get_bits(), given an entry of a layout; see data_get_entry() */
+size_t
+data_get_entry_bits(data_t *data, layout_t *layout, layout_entry_t *entry,
+	byte_t *bytes, size_t size)
+{
+	if (!check_handle(data))
+		return 0;
+
+	if (data->compiled == layout)
+		return get_bits(data, entry, bytes, size);
+
+	data_t view;
+	bind_view(&view, data, layout);
+	return get_bits(&view, entry, bytes, size);
+}
+
+/* moves a segment of data to a range of it, keeping the segment layout */
+bool
+data_move_segment(data_t *segment, data_t *data, size_t offset, size_t length)
+{
+	if (segment->handle != data->handle || segment->arena != data->arena ||
+	    !check_handle(data) || !check_range(data, offset, length))
+		return false;
+
+	segment->offset = data->offset + offset;
+	segment->length = length;
+	bind_extent(segment);
+	return true;
+}
@@ -41,7 +41,11 @@
 #include <lua.h>
 
 #include "handle.h"
+#include "binary.h"
 #include "layout.h"
+#include "arena.h"
+#include "stats.h"
+#include "codec.h"
 
 #define DATA_LIB	"data"
 #define DATA_USERDATA	"data.data"
@@ -50,29 +54,98 @@ typedef struct {
 	handle_t *handle;
 	size_t    offset;
 	size_t    length;
-	int       layout;
+	arena_t  *arena;
+	size_t    generation;
+	bool      cow;
+	layout_t *compiled;        /* header of its layout (user value) */
+	bool      in_bounds;       /* whether it spans all layout fields */
+	bool      words_in_bounds; /* and all the words of fused fields */
+#ifdef DATA_STATS
+	stats_t  *stats;
+	bool      segment;
+#endif
 } data_t;
 
+/* state of an iteration over the TLV elements of a data object */
+typedef struct {
+	size_t position;     /* of the next element, from the data offset */
+	size_t type_width;   /* in bytes; 0 for varints */
+	size_t length_width; /* in bytes; 0 for varints */
+	int    endian;
+} data_tlv_t;
+
+/* state of an iteration over the length-prefixed frames of a data object */
+typedef struct {
+	size_t position;   /* of the next frame, from the data offset */
+	size_t len_offset; /* of the length field, from the frame start */
+	size_t len_width;  /* in bytes; 0 for a varint */
+	size_t header_len; /* bytes of the frame not counted by its length */
+	size_t max_len;    /* greatest valid length */
+	int    endian;
+	bool   invalid;    /* whether a frame exceeded the greatest length */
+} data_frames_t;
+
 data_t * data_new(lua_State *, void *, size_t, bool);
 
+data_t * data_new_arena(lua_State *, arena_t *, void *, size_t);
+
+bool data_rebind(data_t *, void *, size_t);
+
+#ifndef _KERNEL
+shared_token_t * data_export(lua_State *, data_t *);
+
+data_t * data_import(lua_State *, shared_token_t *, bool);
+#endif
+
 #if defined(_KERNEL) && defined(__NetBSD__)
 data_t * data_new_chain(lua_State *, struct mbuf *, bool);
 #endif
 
 int data_new_segment(lua_State *, data_t *, size_t, size_t);
 
+int data_new_cow_segment(lua_State *, data_t *, size_t, size_t);
+
 void data_delete(lua_State *, data_t *);
 
 data_t * data_test(lua_State *, int);
 
-void data_apply_layout(lua_State *, data_t *, int);
+bool data_apply_layout(lua_State *, int, int);
+
+int data_get_field(lua_State *, int, int);
 
-int data_get_field(lua_State *, data_t *, int);
+int data_unpack(lua_State *, int, int, int);
 
-void data_set_field(lua_State *, data_t *, int, int);
+void data_set_field(lua_State *, int, int, int);
+
+int data_get_entry(lua_State *, data_t *, layout_t *, layout_entry_t *);
+
+void data_set_entry(lua_State *, data_t *, layout_t *, layout_entry_t *, int);
+
+size_t data_get_bits(lua_State *, int, int, byte_t *, size_t);
+
+size_t data_get_entry_bits(data_t *, layout_t *, layout_entry_t *, byte_t *,
+	size_t);
+
+bool data_move_segment(data_t *, data_t *, size_t, size_t);
+
+int data_tlv_next(lua_State *, data_t *, data_t *, data_tlv_t *);
+
+int data_frame_next(data_t *, data_t *, data_frames_t *);
 
 void * data_get_ptr(data_t *);
 
+void * data_get_range(lua_State *, data_t *, size_t, size_t, bool);
+
+int data_get_string(lua_State *, data_t *, size_t, size_t, bool);
+
+int data_encode(lua_State *, data_t *, size_t, size_t, codec_t);
+
+bool data_copy(lua_State *, data_t *, size_t, data_t *, size_t, size_t);
+
+bool data_fill(lua_State *, data_t *, int, size_t, size_t);
+
+int data_compare(data_t *, data_t *);
+
 void data_unref(data_t *);
 
 #endif /* _DATA_H_ */
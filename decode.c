@@ -0,0 +1,425 @@
+/*
+ * Copyright (c) 2014, Lourival Vieira Neto <lneto@NetBSD.org>.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the Author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#ifndef _KERNEL
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#else
+#if defined(__NetBSD__)
+#include <sys/param.h>
+#elif defined(__linux__)
+#include <linux/kernel.h>
+#endif
+#endif
+
+#include <lauxlib.h>
+
+#include "luautil.h"
+
+#include "decode.h"
+#include "data.h"
+#include "layout.h"
+
+typedef struct {
+	const char *name;
+	size_t      offset;
+	size_t      length;
+	const char *type;
+} field_t;
+
+typedef struct {
+	const char    *name;
+	const field_t *fields;
+} header_t;
+
+static const field_t ethernet[ ] = {
+	{"dst" , 0 , 6 , "string"},
+	{"src" , 6 , 6 , "string"},
+	{"type", 96, 16, "number"},
+	{NULL  , 0 , 0 , NULL}
+};
+
+static const field_t vlan[ ] = {
+	{"pcp" , 0 , 3 , "number"},
+	{"dei" , 3 , 1 , "number"},
+	{"vid" , 4 , 12, "number"},
+	{"type", 16, 16, "number"},
+	{NULL  , 0 , 0 , NULL}
+};
+
+static const field_t ipv4[ ] = {
+	{"version" , 0  , 4 , "number"},
+	{"ihl"     , 4  , 4 , "number"},
+	{"dscp"    , 8  , 6 , "number"},
+	{"ecn"     , 14 , 2 , "number"},
+	{"length"  , 16 , 16, "number"},
+	{"id"      , 32 , 16, "number"},
+	{"flags"   , 48 , 3 , "number"},
+	{"offset"  , 51 , 13, "number"},
+	{"ttl"     , 64 , 8 , "number"},
+	{"protocol", 72 , 8 , "number"},
+	{"checksum", 80 , 16, "number"},
+	{"src"     , 96 , 32, "number"},
+	{"dst"     , 128, 32, "number"},
+	{NULL      , 0  , 0 , NULL}
+};
+
+static const field_t ipv6[ ] = {
+	{"version", 0 , 4 , "number"},
+	{"class"  , 4 , 8 , "number"},
+	{"flow"   , 12, 20, "number"},
+	{"length" , 32, 16, "number"},
+	{"next"   , 48, 8 , "number"},
+	{"hops"   , 56, 8 , "number"},
+	{"src"    , 8 , 16, "string"},
+	{"dst"    , 24, 16, "string"},
+	{NULL     , 0 , 0 , NULL}
+};
+
+static const field_t extension[ ] = {
+	{"next"  , 0, 8, "number"},
+	{"length", 8, 8, "number"},
+	{NULL    , 0, 0, NULL}
+};
+
+static const field_t tcp[ ] = {
+	{"sport"   , 0  , 16, "number"},
+	{"dport"   , 16 , 16, "number"},
+	{"seq"     , 32 , 32, "number"},
+	{"ack"     , 64 , 32, "number"},
+	{"offset"  , 96 , 4 , "number"},
+	{"flags"   , 104, 8 , "number"},
+	{"window"  , 112, 16, "number"},
+	{"checksum", 128, 16, "number"},
+	{"urgent"  , 144, 16, "number"},
+	{NULL      , 0  , 0 , NULL}
+};
+
+static const field_t udp[ ] = {
+	{"sport"   , 0 , 16, "number"},
+	{"dport"   , 16, 16, "number"},
+	{"length"  , 32, 16, "number"},
+	{"checksum", 48, 16, "number"},
+	{NULL      , 0 , 0 , NULL}
+};
+
+static const header_t headers[ ] = {
+	{"ethernet" , ethernet},
+	{"vlan"     , vlan},
+	{"ipv4"     , ipv4},
+	{"ipv6"     , ipv6},
+	{"extension", extension},
+	{"tcp"      , tcp},
+	{"udp"      , udp},
+	{NULL       , NULL}
+};
+
+/* layers set by decode(); the ones which are not found are set to nil */
+static const char *layers[ ] = {
+	"ethernet", "vlan", "ipv4", "options", "ipv6", "extensions", "tcp",
+	"udp", "payload", "protocol", NULL
+};
+
+#define ETHERNET_LENGTH	(14)
+#define VLAN_LENGTH	(4)
+#define IPV4_LENGTH	(20)
+#define IPV6_LENGTH	(40)
+#define TCP_LENGTH	(20)
+#define UDP_LENGTH	(8)
+
+#define ETHERTYPE_IPV4	(0x0800)
+#define ETHERTYPE_IPV6	(0x86dd)
+#define ETHERTYPE_VLAN	(0x8100)
+#define ETHERTYPE_QINQ	(0x88a8)
+
+#define PROTO_HOPOPTS	(0)
+#define PROTO_TCP	(6)
+#define PROTO_UDP	(17)
+#define PROTO_ROUTING	(43)
+#define PROTO_FRAGMENT	(44)
+#define PROTO_AH	(51)
+#define PROTO_DSTOPTS	(60)
+
+#define IPV4_OFFSET_MASK	(0x1fff)
+
+#define GET16(ptr)	((uint16_t) ((ptr)[ 0 ] << 8 | (ptr)[ 1 ]))
+
+static void
+new_layout(lua_State *L, const field_t *fields)
+{
+	lua_newtable(L);
+	for (const field_t *field = fields; field->name != NULL; field++) {
+		/* spec[ name ] = {offset, length, type} */
+		lua_createtable(L, 3, 0);
+		luau_pushsize(L, field->offset);
+		lua_rawseti(L, -2, 1);
+		luau_pushsize(L, field->length);
+		lua_rawseti(L, -2, 2);
+		lua_pushstring(L, field->type);
+		lua_rawseti(L, -2, 3);
+		lua_setfield(L, -2, field->name);
+	}
+
+	layout_load(L, -1);
+	/* removes spec; keeps layout */
+	lua_remove(L, -2);
+}
+
+void
+decode_open(lua_State *L)
+{
+	lua_newtable(L);
+	for (const header_t *header = headers; header->name != NULL; header++) {
+		new_layout(L, header->fields);
+		lua_setfield(L, -2, header->name);
+	}
+	lua_setfield(L, LUA_REGISTRYINDEX, DECODE_LAYOUTS);
+}
+
+typedef struct {
+	lua_State *L;
+	data_t    *data;
+	int        table_ix;
+	int        layouts_ix;
+} decoder_t;
+
+/* pushes a segment of the data object, with the layout of a header */
+static bool
+push_layer(decoder_t *decoder, size_t offset, size_t length,
+	const char *header)
+{
+	lua_State *L = decoder->L;
+	data_t *data = decoder->data;
+
+	if (data_new_segment(L, data, data->offset + offset, length) == 0)
+		return false;
+
+	if (header != NULL) {
+		lua_getfield(L, decoder->layouts_ix, header);
+		data_apply_layout(L, -2, -1);
+		lua_pop(L, 1);
+	}
+	return true;
+}
+
+static void
+set_layer(decoder_t *decoder, const char *name, size_t offset, size_t length,
+	const char *header)
+{
+	if (push_layer(decoder, offset, length, header))
+		lua_setfield(decoder->L, decoder->table_ix, name);
+}
+
+/* appends a layer to the array of name, creating it if needed */
+static void
+append_layer(decoder_t *decoder, const char *name, lua_Integer n,
+	size_t offset, size_t length, const char *header)
+{
+	lua_State *L = decoder->L;
+
+	if (n == 1) {
+		lua_newtable(L);
+		lua_setfield(L, decoder->table_ix, name);
+	}
+
+	lua_getfield(L, decoder->table_ix, name);
+	if (push_layer(decoder, offset, length, header))
+		lua_rawseti(L, -2, n);
+	lua_pop(L, 1);
+}
+
+inline static bool
+is_extension(uint8_t next)
+{
+	return next == PROTO_HOPOPTS || next == PROTO_ROUTING ||
+		next == PROTO_FRAGMENT || next == PROTO_AH ||
+		next == PROTO_DSTOPTS;
+}
+
+/*
+ * walks the headers of an Ethernet frame from offset and sets their layers;
+ * it returns the offset of the payload and sets end to the end of the
+ * network packet (e.g., leaving the Ethernet padding out)
+ */
+static size_t
+decode_frame(decoder_t *decoder, const uint8_t *ptr, size_t *end)
+{
+	size_t offset = 0;
+
+	if (*end < ETHERNET_LENGTH)
+		return offset;
+
+	set_layer(decoder, "ethernet", offset, ETHERNET_LENGTH, "ethernet");
+	uint16_t type = GET16(ptr + 12);
+	offset += ETHERNET_LENGTH;
+
+	for (lua_Integer n = 1; n <= DECODE_MAX_VLANS && (type ==
+		ETHERTYPE_VLAN || type == ETHERTYPE_QINQ); n++) {
+		if (*end - offset < VLAN_LENGTH)
+			return offset;
+
+		append_layer(decoder, "vlan", n, offset, VLAN_LENGTH, "vlan");
+		type = GET16(ptr + offset + 2);
+		offset += VLAN_LENGTH;
+	}
+
+	int  protocol = 0;
+	bool fragment = false;
+
+	if (type == ETHERTYPE_IPV4) {
+		const uint8_t *ip = ptr + offset;
+		if (*end - offset < IPV4_LENGTH || ip[ 0 ] >> 4 != 4)
+			return offset;
+
+		size_t length = (ip[ 0 ] & 0xf) * 4;
+		size_t total  = GET16(ip + 2);
+		if (length < IPV4_LENGTH || total < length ||
+			total > *end - offset)
+			return offset;
+
+		set_layer(decoder, "ipv4", offset, length, "ipv4");
+		if (length > IPV4_LENGTH)
+			set_layer(decoder, "options", offset + IPV4_LENGTH,
+				length - IPV4_LENGTH, NULL);
+
+		protocol = ip[ 9 ];
+		fragment = (GET16(ip + 6) & IPV4_OFFSET_MASK) != 0;
+		*end     = offset + total;
+		offset  += length;
+	}
+	else if (type == ETHERTYPE_IPV6) {
+		const uint8_t *ip = ptr + offset;
+		if (*end - offset < IPV6_LENGTH || ip[ 0 ] >> 4 != 6)
+			return offset;
+
+		/* a zero payload length is used by jumbograms */
+		size_t length = GET16(ip + 4);
+		if (length > *end - offset - IPV6_LENGTH)
+			return offset;
+		if (length > 0)
+			*end = offset + IPV6_LENGTH + length;
+
+		set_layer(decoder, "ipv6", offset, IPV6_LENGTH, "ipv6");
+		protocol = ip[ 6 ];
+		fragment = false;
+		offset  += IPV6_LENGTH;
+
+		for (lua_Integer n = 1; n <= DECODE_MAX_EXTENSIONS &&
+			is_extension(protocol); n++) {
+			const uint8_t *ext = ptr + offset;
+			if (*end - offset < 8)
+				return offset;
+
+			if (protocol == PROTO_FRAGMENT) {
+				length = 8;
+				fragment = GET16(ext + 2) >> 3 != 0;
+			}
+			else if (protocol == PROTO_AH)
+				length = (ext[ 1 ] + 2) * 4;
+			else
+				length = (ext[ 1 ] + 1) * 8;
+
+			if (length > *end - offset)
+				return offset;
+
+			append_layer(decoder, "extensions", n, offset, length,
+				"extension");
+			protocol = ext[ 0 ];
+			offset  += length;
+		}
+		if (is_extension(protocol))
+			return offset;
+	}
+	else
+		return offset;
+
+	lua_pushinteger(decoder->L, protocol);
+	lua_setfield(decoder->L, decoder->table_ix, "protocol");
+
+	/* only first fragments have transport headers */
+	if (fragment)
+		return offset;
+
+	if (protocol == PROTO_TCP) {
+		if (*end - offset < TCP_LENGTH)
+			return offset;
+
+		size_t length = (ptr[ offset + 12 ] >> 4) * 4;
+		if (length < TCP_LENGTH || length > *end - offset)
+			return offset;
+
+		set_layer(decoder, "tcp", offset, length, "tcp");
+		offset += length;
+	}
+	else if (protocol == PROTO_UDP) {
+		if (*end - offset < UDP_LENGTH)
+			return offset;
+
+		set_layer(decoder, "udp", offset, UDP_LENGTH, "udp");
+		offset += UDP_LENGTH;
+	}
+	return offset;
+}
+
+int
+decode(lua_State *L, data_t *data, int table_ix)
+{
+	const uint8_t *ptr = (const uint8_t *) data_get_ptr(data);
+	if (ptr == NULL)
+		return 0;
+
+	/* fills the given table, if any */
+	if (table_ix != 0 && lua_istable(L, table_ix))
+		lua_pushvalue(L, table_ix);
+	else
+		lua_createtable(L, 0, 4);
+
+	for (const char **layer = layers; *layer != NULL; layer++) {
+		lua_pushnil(L);
+		lua_setfield(L, -2, *layer);
+	}
+
+	lua_getfield(L, LUA_REGISTRYINDEX, DECODE_LAYOUTS);
+
+	decoder_t decoder;
+	decoder.L          = L;
+	decoder.data       = data;
+	decoder.table_ix   = lua_gettop(L) - 1;
+	decoder.layouts_ix = lua_gettop(L);
+
+	size_t end    = data->length;
+	size_t offset = decode_frame(&decoder, ptr, &end);
+
+	/* anything further up is left for user layouts */
+	if (offset < end)
+		set_layer(&decoder, "payload", offset, end - offset, NULL);
+
+	/* removes layouts; keeps table */
+	lua_pop(L, 1);
+	return 1;
+}
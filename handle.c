@@ -38,6 +38,24 @@
 #include "luautil.h"
 
 #include "handle.h"
+#include "probes.h"
+
+#ifdef DATA_STATS
+static size_t
+handle_size(handle_t *handle)
+{
+	switch (handle->type) {
+	case HANDLE_TYPE_SINGLE:
+		return handle->bucket.single.size;
+	case HANDLE_TYPE_CHAIN:
+#if defined(_KERNEL) && defined(__NetBSD__)
+		return m_length(handle->bucket.chain);
+#endif
+		break;
+	}
+	return 0;
+}
+#endif
 
 static void
 free_handle(lua_State *L, handle_t *handle)
@@ -45,8 +63,17 @@ free_handle(lua_State *L, handle_t *handle)
 	switch (handle->type) {
 	case HANDLE_TYPE_SINGLE:
 	{
+#ifndef _KERNEL
+		if (handle->shared != NULL) {
+			/* the writer (if any) is the only one not read-only */
+			if (!handle->readonly)
+				shared_unlock_writer(handle->shared);
+			shared_release(handle->shared);
+			break;
+		}
+#endif
 		single_t *single = &handle->bucket.single;
-		luau_free(L, single->ptr, single->size);
+		luau_free(L, single->ptr, ALLOC_SIZE(single->size));
 		break;
 	}
 	case HANDLE_TYPE_CHAIN:
@@ -60,14 +87,20 @@ free_handle(lua_State *L, handle_t *handle)
 	}
 }
 
-handle_t *
-handle_new_single(lua_State *L, void *ptr, size_t size, bool free)
+void *
+handle_alloc(lua_State *L, size_t size)
 {
-	handle_t *handle = (handle_t *) luau_malloc(L, sizeof(handle_t));
-
-	if (handle == NULL)
+	char *ptr = (char *) luau_malloc(L, ALLOC_SIZE(size));
+	if (ptr == NULL)
 		return NULL;
 
+	ptr[ size ] = '\0';
+	return ptr;
+}
+
+void
+handle_init_single(handle_t *handle, void *ptr, size_t size, bool free)
+{
 	single_t *single = &handle->bucket.single;
 	single->ptr  = ptr;
 	single->size = size;
@@ -75,10 +108,79 @@ handle_new_single(lua_State *L, void *ptr, size_t size, bool free)
 	handle->type     = HANDLE_TYPE_SINGLE;
 	handle->refcount = 0;
 	handle->free     = free;
+	handle->readonly = false;
+#if LUA_VERSION_NUM >= 505
+	handle->nstrings = 0;
+#endif
+#ifndef _KERNEL
+	handle->shared   = NULL;
+#endif
+}
 
+handle_t *
+handle_new_single(lua_State *L, void *ptr, size_t size, bool free)
+{
+	handle_t *handle = (handle_t *) luau_malloc(L, sizeof(handle_t));
+
+	if (handle == NULL)
+		return NULL;
+
+	handle_init_single(handle, ptr, size, free);
+
+#ifdef DATA_STATS
+	handle->stats = stats_get(L);
+	STATS_INC(handle->stats, handles);
+	if (free)
+		STATS_ADD(handle->stats, bytes, size);
+#endif
 	return handle;
 }
 
+#ifndef _KERNEL
+shared_t *
+handle_share(lua_State *L, handle_t *handle)
+{
+	if (handle->shared != NULL)
+		return handle->shared;
+
+	/* only raw data owned by the handle can be handed over */
+	single_t *single = &handle->bucket.single;
+	if (handle->type != HANDLE_TYPE_SINGLE || !handle->free ||
+		single->ptr == NULL)
+		return NULL;
+
+	shared_t *shared = shared_new(L, single->ptr, single->size);
+	if (shared == NULL)
+		return NULL;
+
+	/* writers must be imported explicitly; see handle_new_shared() */
+	handle->shared   = shared;
+	handle->readonly = true;
+	return shared;
+}
+
+handle_t *
+handle_new_shared(lua_State *L, shared_t *shared, bool writer)
+{
+	if (writer && !shared_lock_writer(shared))
+		return NULL;
+
+	handle_t *handle = handle_new_single(L, shared->ptr, shared->size,
+		true);
+	if (handle == NULL) {
+		if (writer)
+			shared_unlock_writer(shared);
+		return NULL;
+	}
+
+	shared_retain(shared);
+
+	handle->shared   = shared;
+	handle->readonly = !writer;
+	return handle;
+}
+#endif
+
 #if defined(_KERNEL) && defined(__NetBSD__)
 handle_t *
 handle_new_chain(lua_State *L, struct mbuf *chain, bool free)
@@ -93,7 +195,17 @@ handle_new_chain(lua_State *L, struct mbuf *chain, bool free)
 	handle->type     = HANDLE_TYPE_CHAIN;
 	handle->refcount = 0;
 	handle->free     = free;
+	handle->readonly = false;
+#if LUA_VERSION_NUM >= 505
+	handle->nstrings = 0;
+#endif
 
+#ifdef DATA_STATS
+	handle->stats = stats_get(L);
+	STATS_INC(handle->stats, handles);
+	if (free)
+		STATS_ADD(handle->stats, bytes, m_length(chain));
+#endif
 	return handle;
 }
 #endif
@@ -101,11 +213,22 @@ handle_new_chain(lua_State *L, struct mbuf *chain, bool free)
 void
 handle_delete(lua_State *L, handle_t *handle)
 {
+	DATA_PROBE2(handle_delete, handle, handle->refcount);
+
 	if (handle->refcount == 0) {
+#ifdef DATA_STATS
+		stats_t *stats = handle->stats;
+		STATS_DEC(stats, handles);
+		if (handle->free)
+			STATS_SUB(stats, bytes, handle_size(handle));
+#endif
 		if (handle->free)
 			free_handle(L, handle);
 
 		luau_free(L, handle, sizeof(handle_t));
+#ifdef DATA_STATS
+		stats_release(L, stats);
+#endif
 	}
 	else
 		handle->refcount--;
@@ -116,6 +239,8 @@ handle_get_ptr(handle_t *handle, size_t offset, size_t length)
 {
 	void *ptr = NULL;
 
+	DATA_PROBE3(handle_get_ptr, handle, offset, length);
+
 	switch (handle->type) {
 	case HANDLE_TYPE_SINGLE:
 	{
@@ -133,6 +258,7 @@ handle_get_ptr(handle_t *handle, size_t offset, size_t length)
 		if (chain == NULL || offset > INT_MAX || length > INT_MAX)
 			return NULL;
 
+		STATS_INC(handle->stats, pulldowns);
 		struct mbuf *m = m_pulldown(chain, (int) offset, (int) length,
 				NULL);
 		if (m == NULL)
@@ -167,3 +293,45 @@ handle_unref(handle_t *handle)
 	}
 }
 
+#if LUA_VERSION_NUM >= 505
+static void *
+release_string(void *ud, void *ptr, size_t osize, size_t nsize)
+{
+	handle_t *handle = (handle_t *) ud;
+
+	/* the string has been collected; drop its reference */
+	handle->nstrings--;
+	handle_delete(handle->owner, handle);
+	return NULL;
+}
+
+bool
+handle_pushstring(lua_State *L, handle_t *handle, size_t offset,
+	size_t length)
+{
+	if (handle->type != HANDLE_TYPE_SINGLE || !handle->free)
+		return false;
+
+	/* shared raw data might be written by another Lua state */
+	if (handle->shared != NULL)
+		return false;
+
+	/* external strings must be NUL terminated; see handle_alloc() */
+	single_t *single = &handle->bucket.single;
+	if (single->ptr == NULL || offset + length != single->size)
+		return false;
+
+	/* the string might outlive the thread which has pushed it */
+	lua_rawgeti(L, LUA_REGISTRYINDEX, LUA_RIDX_MAINTHREAD);
+	handle->owner = lua_tothread(L, -1);
+	lua_pop(L, 1);
+
+	/* Lua strings are immutable; see HANDLE_WRITABLE() */
+	handle->nstrings++;
+	handle->refcount++;
+
+	const char *s = (const char *) single->ptr + offset;
+	lua_pushexternalstring(L, s, length, release_string, handle);
+	return true;
+}
+#endif
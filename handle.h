@@ -40,6 +40,14 @@
 
 #include <lua.h>
 
+#include "stats.h"
+#ifndef _KERNEL
+#include "shared.h"
+#endif
+
+/* owned buffers carry a trailing NUL, so they can back Lua strings */
+#define ALLOC_SIZE(size)	(size + 1)
+
 typedef struct {
 	void  *ptr;
 	size_t size;
@@ -62,18 +70,51 @@ typedef struct {
 	handle_type_t type;
 	size_t        refcount;
 	bool          free;
+	bool          readonly;
+#if LUA_VERSION_NUM >= 505
+	lua_State    *owner;
+	size_t        nstrings; /* external strings referencing it */
+#endif
+#ifdef DATA_STATS
+	stats_t      *stats;
+#endif
+#ifndef _KERNEL
+	shared_t     *shared;
+#endif
 } handle_t;
 
+/* raw data referenced by Lua strings is read-only until they are collected */
+#if LUA_VERSION_NUM >= 505
+#define HANDLE_WRITABLE(handle) \
+	(!(handle)->readonly && (handle)->nstrings == 0)
+#else
+#define HANDLE_WRITABLE(handle)	(!(handle)->readonly)
+#endif
+
+void * handle_alloc(lua_State *, size_t);
+
+void handle_init_single(handle_t *, void *, size_t, bool);
+
 handle_t * handle_new_single(lua_State *, void *, size_t, bool);
 
 #if defined(_KERNEL) && defined(__NetBSD__)
 handle_t * handle_new_chain(lua_State *, struct mbuf *, bool);
 #endif
 
+#ifndef _KERNEL
+shared_t * handle_share(lua_State *, handle_t *);
+
+handle_t * handle_new_shared(lua_State *, shared_t *, bool);
+#endif
+
 void handle_delete(lua_State *, handle_t *);
 
 void * handle_get_ptr(handle_t *, size_t, size_t);
 
 void handle_unref(handle_t *);
 
+#if LUA_VERSION_NUM >= 505
+bool handle_pushstring(lua_State *, handle_t *, size_t, size_t);
+#endif
+
 #endif /* _HANDLE_H_ */
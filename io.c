@@ -0,0 +1,441 @@
+/*
+ * Copyright (c) 2014, Lourival Vieira Neto <lneto@NetBSD.org>.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the Author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <sys/param.h>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define IO_URING
+#include <stdint.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+#endif
+
+#include <lauxlib.h>
+
+#include "luautil.h"
+
+#include "io.h"
+
+#ifndef IOV_MAX
+#define IOV_MAX		(1024)
+#endif
+
+/* data objects are resolved to their bytes only when a batch is submitted */
+typedef struct {
+	struct iovec iov;
+	int          fd;
+	io_op_t      op;
+	off_t        position;	/* or -1, for the current file offset */
+	int64_t      result;	/* bytes transferred or -errno */
+} io_request_t;
+
+#ifdef IO_URING
+typedef struct {
+	int                  fd;
+	void                *sq;
+	size_t               sq_size;
+	void                *cq;
+	size_t               cq_size;
+	struct io_uring_sqe *sqes;
+	size_t               sqes_size;
+	atomic_uint         *sq_tail;
+	unsigned            *sq_mask;
+	unsigned            *sq_array;
+	atomic_uint         *cq_head;
+	atomic_uint         *cq_tail;
+	unsigned            *cq_mask;
+	struct io_uring_cqe *cqes;
+} io_uring_t;
+#endif
+
+struct io_batch {
+#ifdef IO_URING
+	io_uring_t   ring;	/* ring.fd is -1 if unavailable */
+#endif
+	size_t       capacity;
+	size_t       count;
+	io_request_t requests[ ];
+};
+
+static ssize_t
+transfer(int fd, io_op_t op, struct iovec *iov, int iovcnt, off_t position)
+{
+	ssize_t n;
+
+	do {
+		if (position < 0)
+			n = op == IO_READ ? readv(fd, iov, iovcnt) :
+				writev(fd, iov, iovcnt);
+		else
+			n = op == IO_READ ? preadv(fd, iov, iovcnt, position) :
+				pwritev(fd, iov, iovcnt, position);
+	} while (n < 0 && errno == EINTR);
+	return n;
+}
+
+static int
+push_result(lua_State *L, ssize_t n)
+{
+	if (n < 0) {
+		lua_pushnil(L);
+		lua_pushinteger(L, errno);
+		return 2;
+	}
+
+	luau_pushsize(L, (size_t) n);
+	return 1;
+}
+
+/* transfers a range of a data object in place, with a single system call */
+int
+io_transfer(lua_State *L, io_op_t op, int fd, data_t *data, size_t offset,
+	size_t length, off_t position)
+{
+	struct iovec iov;
+
+	iov.iov_base = data_get_range(L, data, offset, length, op == IO_READ);
+	iov.iov_len  = length;
+	if (fd < 0 || iov.iov_base == NULL)
+		return 0;
+
+	return push_result(L, transfer(fd, op, &iov, 1, position));
+}
+
+/* transfers the data objects of a list in place, with a single system call */
+int
+io_vector(lua_State *L, io_op_t op, int fd, int list_ix, off_t position)
+{
+	struct iovec iov[ IOV_MAX ];
+
+#if LUA_VERSION_NUM >= 502
+	size_t n = lua_rawlen(L, list_ix);
+#else
+	size_t n = lua_objlen(L, list_ix);
+#endif
+	if (fd < 0 || n == 0 || n > IOV_MAX)
+		return 0;
+
+	for (size_t i = 0; i < n; i++) {
+		/* the list keeps the data object alive */
+		lua_rawgeti(L, list_ix, (lua_Integer) i + 1);
+		data_t *data = data_test(L, -1);
+		lua_pop(L, 1);
+		if (data == NULL)
+			return 0;
+
+		iov[ i ].iov_base = data_get_range(L, data, 0, data->length,
+			op == IO_READ);
+		iov[ i ].iov_len  = data->length;
+		if (iov[ i ].iov_base == NULL)
+			return 0;
+	}
+
+	return push_result(L, transfer(fd, op, iov, (int) n, position));
+}
+
+#ifdef IO_URING
+static void
+uring_close(io_uring_t *ring)
+{
+	if (ring->fd < 0)
+		return;
+
+	munmap(ring->sqes, ring->sqes_size);
+	if (ring->cq != ring->sq)
+		munmap(ring->cq, ring->cq_size);
+	munmap(ring->sq, ring->sq_size);
+	close(ring->fd);
+	ring->fd = -1;
+}
+
+static void *
+uring_map(int fd, size_t size, off_t offset)
+{
+	void *ptr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, fd, offset);
+	return ptr == MAP_FAILED ? NULL : ptr;
+}
+
+/* sets up a ring for entries requests; leaves ring->fd as -1 on failure */
+static void
+uring_open(io_uring_t *ring, size_t entries)
+{
+	struct io_uring_params params;
+	memset(&params, 0, sizeof(params));
+	memset(ring, 0, sizeof(io_uring_t));
+
+	ring->fd = (int) syscall(__NR_io_uring_setup, (unsigned) entries,
+		&params);
+	if (ring->fd < 0) {
+		ring->fd = -1;
+		return;
+	}
+
+	ring->sq_size = params.sq_off.array +
+		params.sq_entries * sizeof(unsigned);
+	ring->cq_size = params.cq_off.cqes +
+		params.cq_entries * sizeof(struct io_uring_cqe);
+	if (params.features & IORING_FEAT_SINGLE_MMAP)
+		ring->sq_size = ring->cq_size = MAX(ring->sq_size,
+			ring->cq_size);
+	ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+	ring->sq = uring_map(ring->fd, ring->sq_size, IORING_OFF_SQ_RING);
+	ring->cq = (params.features & IORING_FEAT_SINGLE_MMAP) ? ring->sq :
+		(ring->sq != NULL ? uring_map(ring->fd, ring->cq_size,
+		IORING_OFF_CQ_RING) : NULL);
+	ring->sqes = ring->cq != NULL ? (struct io_uring_sqe *) uring_map(
+		ring->fd, ring->sqes_size, IORING_OFF_SQES) : NULL;
+
+	if (ring->sqes == NULL) {
+		if (ring->cq != NULL && ring->cq != ring->sq)
+			munmap(ring->cq, ring->cq_size);
+		if (ring->sq != NULL)
+			munmap(ring->sq, ring->sq_size);
+		close(ring->fd);
+		ring->fd = -1;
+		return;
+	}
+
+	char *sq = (char *) ring->sq;
+	char *cq = (char *) ring->cq;
+	ring->sq_tail  = (atomic_uint *) (sq + params.sq_off.tail);
+	ring->sq_mask  = (unsigned *) (sq + params.sq_off.ring_mask);
+	ring->sq_array = (unsigned *) (sq + params.sq_off.array);
+	ring->cq_head  = (atomic_uint *) (cq + params.cq_off.head);
+	ring->cq_tail  = (atomic_uint *) (cq + params.cq_off.tail);
+	ring->cq_mask  = (unsigned *) (cq + params.cq_off.ring_mask);
+	ring->cqes     = (struct io_uring_cqe *) (cq + params.cq_off.cqes);
+}
+
+static size_t
+uring_reap(io_uring_t *ring, io_batch_t *batch)
+{
+	unsigned head = atomic_load_explicit(ring->cq_head,
+		memory_order_relaxed);
+	unsigned tail = atomic_load_explicit(ring->cq_tail,
+		memory_order_acquire);
+
+	size_t completed = 0;
+	for (; head != tail; head++, completed++) {
+		struct io_uring_cqe *cqe = &ring->cqes[ head & *ring->cq_mask ];
+		batch->requests[ cqe->user_data ].result = cqe->res;
+	}
+
+	atomic_store_explicit(ring->cq_head, head, memory_order_release);
+	return completed;
+}
+
+/* submits every pending request at once and waits for all of them */
+static void
+uring_submit(io_uring_t *ring, io_batch_t *batch)
+{
+	unsigned tail = atomic_load_explicit(ring->sq_tail,
+		memory_order_relaxed);
+
+	size_t pending = 0;
+	for (size_t i = 0; i < batch->count; i++) {
+		io_request_t *request = &batch->requests[ i ];
+		if (request->result != -ECANCELED)
+			continue;
+
+		unsigned index = tail++ & *ring->sq_mask;
+		pending++;
+
+		struct io_uring_sqe *sqe = &ring->sqes[ index ];
+		memset(sqe, 0, sizeof(struct io_uring_sqe));
+		sqe->opcode    = request->op == IO_READ ? IORING_OP_READV :
+			IORING_OP_WRITEV;
+		sqe->fd        = request->fd;
+		sqe->addr      = (uint64_t) (uintptr_t) &request->iov;
+		sqe->len       = 1;
+		sqe->off       = (uint64_t) request->position;
+		sqe->user_data = i;
+
+		ring->sq_array[ index ] = index;
+	}
+	atomic_store_explicit(ring->sq_tail, tail, memory_order_release);
+
+	size_t submitted = 0;
+	size_t completed = 0;
+	while (completed < pending) {
+		int n = (int) syscall(__NR_io_uring_enter, ring->fd,
+			(unsigned) (pending - submitted),
+			(unsigned) (pending - completed),
+			IORING_ENTER_GETEVENTS, NULL, 0);
+		if (n < 0 && errno != EINTR) {
+			/* requests left behind would be submitted later on */
+			int error = errno;
+			for (size_t i = 0; i < batch->count; i++)
+				if (batch->requests[ i ].result == -ECANCELED)
+					batch->requests[ i ].result = -error;
+			uring_close(ring);
+			return;
+		}
+
+		if (n > 0)
+			submitted += n;
+		completed += uring_reap(ring, batch);
+	}
+}
+#endif
+
+io_batch_t *
+io_batch_new(lua_State *L, size_t capacity, bool uring)
+{
+	io_batch_t *batch = (io_batch_t *) lua_newuserdata(L,
+		sizeof(io_batch_t) + capacity * sizeof(io_request_t));
+	batch->capacity = capacity;
+	batch->count    = 0;
+
+#ifdef IO_URING
+	batch->ring.fd = -1;
+	if (uring)
+		uring_open(&batch->ring, capacity);
+#endif
+
+	luau_setmetatable(L, IO_BATCH_USERDATA);
+
+	/* data objects of queued requests are kept alive in the user value */
+	lua_newtable(L);
+	luau_setuservalue(L, -2);
+	return batch;
+}
+
+/*
+ * queues the whole extent of a data object; its bytes are resolved again on
+ * submit, as they might be moved or released in between
+ */
+bool
+io_batch_add(lua_State *L, int batch_ix, io_op_t op, int fd, int data_ix,
+	off_t position)
+{
+	io_batch_t *batch = (io_batch_t *) lua_touserdata(L, batch_ix);
+	data_t     *data  = data_test(L, data_ix);
+	if (data == NULL || fd < 0 || batch->count == batch->capacity)
+		return false;
+
+	if (data_get_range(L, data, 0, data->length, op == IO_READ) == NULL)
+		return false;
+
+	io_request_t *request = &batch->requests[ batch->count ];
+	request->iov.iov_base = NULL;
+	request->iov.iov_len  = 0;
+	request->fd           = fd;
+	request->op           = op;
+	request->position     = position;
+	request->result       = -ECANCELED;
+
+	data_ix = luau_absindex(L, data_ix);
+	luau_getuservalue(L, batch_ix);
+	lua_pushvalue(L, data_ix);
+	lua_rawseti(L, -2, (lua_Integer) ++batch->count);
+	lua_pop(L, 1);
+	return true;
+}
+
+/* submits the queued requests, waits for them and pushes their results */
+int
+io_batch_submit(lua_State *L, int batch_ix)
+{
+	io_batch_t *batch = (io_batch_t *) lua_touserdata(L, batch_ix);
+	batch_ix = luau_absindex(L, batch_ix);
+
+	/* requests whose data is no longer valid fail with EINVAL */
+	luau_getuservalue(L, batch_ix);
+	for (size_t i = 0; i < batch->count; i++) {
+		io_request_t *request = &batch->requests[ i ];
+
+		lua_rawgeti(L, -1, (lua_Integer) i + 1);
+		data_t *data = data_test(L, -1);
+		lua_pop(L, 1);
+
+		request->iov.iov_base = data_get_range(L, data, 0,
+			data->length, request->op == IO_READ);
+		request->iov.iov_len  = data->length;
+		if (request->iov.iov_base == NULL)
+			request->result = -EINVAL;
+	}
+	lua_pop(L, 1);
+
+#ifdef IO_URING
+	if (batch->ring.fd >= 0 && batch->count > 0)
+		uring_submit(&batch->ring, batch);
+	else
+#endif
+	for (size_t i = 0; i < batch->count; i++) {
+		io_request_t *request = &batch->requests[ i ];
+		if (request->result != -ECANCELED)
+			continue;
+
+		ssize_t n = transfer(request->fd, request->op, &request->iov, 1,
+			request->position);
+		request->result = n < 0 ? -errno : n;
+	}
+
+	lua_createtable(L, (int) batch->count, 0);
+	for (size_t i = 0; i < batch->count; i++) {
+		lua_pushinteger(L, (lua_Integer) batch->requests[ i ].result);
+		lua_rawseti(L, -2, (lua_Integer) i + 1);
+	}
+
+	/* releases the data objects of the submitted requests */
+	batch->count = 0;
+	lua_newtable(L);
+	luau_setuservalue(L, batch_ix);
+	return 1;
+}
+
+bool
+io_batch_uring(io_batch_t *batch)
+{
+#ifdef IO_URING
+	return batch->ring.fd >= 0;
+#else
+	(void) batch;
+	return false;
+#endif
+}
+
+void
+io_batch_delete(io_batch_t *batch)
+{
+#ifdef IO_URING
+	uring_close(&batch->ring);
+#else
+	(void) batch;
+#endif
+}
@@ -0,0 +1,63 @@
+/*
+ * Copyright (c) 2014, Lourival Vieira Neto <lneto@NetBSD.org>.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the Author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#ifndef _IO_H_
+#define _IO_H_
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include <lua.h>
+
+#include "data.h"
+
+#define IO_BATCH_USERDATA	"data.batch"
+
+typedef enum {
+	IO_READ = 0,
+	IO_WRITE
+} io_op_t;
+
+/* batch of transfers, submitted at once through io_uring where available */
+typedef struct io_batch io_batch_t;
+
+int io_transfer(lua_State *, io_op_t, int, data_t *, size_t, size_t, off_t);
+
+int io_vector(lua_State *, io_op_t, int, int, off_t);
+
+io_batch_t * io_batch_new(lua_State *, size_t, bool);
+
+bool io_batch_add(lua_State *, int, io_op_t, int, int, off_t);
+
+int io_batch_submit(lua_State *, int);
+
+bool io_batch_uring(io_batch_t *);
+
+void io_batch_delete(io_batch_t *);
+
+#endif /* _IO_H_ */
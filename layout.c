@@ -25,24 +25,28 @@
  * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
  * SUCH DAMAGE.
  */
+#ifndef _KERNEL
+#include <limits.h>
+#include <sys/param.h>
+#else
+#if defined(__NetBSD__)
+#include <machine/limits.h>
+#include <sys/param.h>
+#elif defined(__linux__)
+#include <linux/kernel.h>
+#endif
+#endif
+
 #include <lua.h>
 #include <lauxlib.h>
 
 #include "luautil.h"
 
+#include "binary.h"
 #include "layout.h"
 
-inline static layout_entry_t *
-test_entry(lua_State *L, int index)
-{
-#if LUA_VERSION_NUM >= 502
-	return (layout_entry_t *)
-		luaL_testudata(L, index, LAYOUT_ENTRY_USERDATA);
-#else
-	return (layout_entry_t *)
-		luaL_checkudata(L, index, LAYOUT_ENTRY_USERDATA);
-#endif
-}
+/* its address keys the fields of compiled layouts, and their headers */
+static const char layout_key = 0;
 
 inline static void
 init_layout(layout_entry_t *entry)
@@ -51,6 +55,7 @@ init_layout(layout_entry_t *entry)
 	entry->length = 0;
 	entry->type   = LAYOUT_TYPE_DEFAULT;
 	entry->endian = LAYOUT_ENDIAN_DEFAULT;
+	entry->layout = NULL;
 }
 
 static void
@@ -62,22 +67,19 @@ load_type(lua_State *L, layout_entry_t *entry)
 		entry->type = LAYOUT_TNUMBER;
 	else if (type[0] == 's')
 		entry->type = LAYOUT_TSTRING;
+	else if (type[0] == 'v')
+		entry->type = LAYOUT_TVARINT;
+	else if (type[0] == 'z')
+		entry->type = LAYOUT_TZIGZAG;
 }
 
 static void
 load_endian(lua_State *L, layout_entry_t *entry)
 {
-	const char *endian = lua_tostring(L, -1);
-
-	if (endian[0] == 'n' || endian[0] == 'b')
-		entry->endian = BIG_ENDIAN;
-	else if (endian[0] == 'l')
-		entry->endian = LITTLE_ENDIAN;
-	else if (endian[0] == 'h')
-		entry->endian = BYTE_ORDER;
+	entry->endian = layout_endian(lua_tostring(L, -1), entry->endian);
 }
 
-static void
+static size_t
 load_entry_numbered(lua_State *L, layout_entry_t *entry)
 {
 #if LUA_VERSION_NUM >= 502
@@ -100,6 +102,29 @@ load_entry_numbered(lua_State *L, layout_entry_t *entry)
 		load_endian(L, entry);
 		lua_pop(L, 1);
 	}
+	return array_len;
+}
+
+/* checks whether the entry spec on top may have named members */
+static bool
+has_named(lua_State *L, size_t array_len)
+{
+	if (lua_getmetatable(L, -1)) {
+		lua_pop(L, 1);
+		return true;
+	}
+
+	/* looks for any key following its array */
+	if (array_len > 0)
+		luau_pushsize(L, array_len);
+	else
+		lua_pushnil(L);
+
+	if (lua_next(L, -2) == 0)
+		return false;
+
+	lua_pop(L, 2);
+	return true;
 }
 
 static void
@@ -126,12 +151,32 @@ load_entry_named(lua_State *L, layout_entry_t *entry)
 	lua_pop(L, 1);
 }
 
+/*
+ * groups number entries by the aligned word they lie in, so the ones sharing
+ * a word can be extracted from a single load of it; entries crossing a word
+ * boundary and little-endian multi-byte entries are not fused
+ */
+static void
+group_entry(layout_entry_t *entry)
+{
+	size_t word_offset = entry->offset % BINARY_WORD_BIT;
+
+	entry->word  = entry->offset / BINARY_WORD_BIT * BINARY_WORD_BYTE;
+	entry->fused = entry->type == LAYOUT_TNUMBER && entry->length > 0 &&
+		word_offset + entry->length <= BINARY_WORD_BIT &&
+		(entry->length <= BYTE_BIT || entry->endian == BIG_ENDIAN);
+	entry->shift = entry->fused ?
+		BINARY_WORD_BIT - word_offset - entry->length : 0;
+}
+
 static void
 load_entry(lua_State *L, layout_entry_t *entry)
 {
 	init_layout(entry);
-	load_entry_numbered(L, entry);
-	load_entry_named(L, entry);
+	size_t array_len = load_entry_numbered(L, entry);
+	if (has_named(L, array_len))
+		load_entry_named(L, entry);
+	group_entry(entry);
 }
 
 static void
@@ -141,10 +186,14 @@ copy_entry(layout_entry_t *dst, layout_entry_t *src)
 	dst->length = src->length;
 	dst->type   = src->type;
 	dst->endian = src->endian;
+	dst->word   = src->word;
+	dst->shift  = src->shift;
+	dst->fused  = src->fused;
+	dst->layout = src->layout;
 }
 
 static int
-new_entry(lua_State *L, layout_entry_t *entry)
+new_entry(lua_State *L, layout_entry_t *entry, const layout_t *layout)
 {
 	layout_entry_t *nentry =
 		(layout_entry_t *) lua_newuserdata(L, sizeof(layout_entry_t));
@@ -152,48 +201,378 @@ new_entry(lua_State *L, layout_entry_t *entry)
 	luau_setmetatable(L, LAYOUT_ENTRY_USERDATA);
 
 	copy_entry(nentry, entry);
+	nentry->layout = layout;
 	return 1;
 }
 
-void
-layout_load(lua_State *L, int index)
+/* updates the extents of a layout with the bytes spanned by an entry */
+static void
+extend_layout(layout_t *layout, layout_entry_t *entry)
+{
+	size_t extent = entry->type == LAYOUT_TNUMBER ?
+		BIT_TO_BYTE(entry->offset + entry->length) :
+		entry->offset + entry->length;
+
+	layout->extent = MAX(layout->extent, extent);
+	if (entry->fused)
+		layout->word_extent = MAX(layout->word_extent,
+			entry->word + BINARY_WORD_BYTE);
+}
+
+static int
+modify_layout(lua_State *L)
+{
+	return luaL_error(L, "attempt to modify a layout");
+}
+
+static void
+compile_layout(lua_State *L, int index)
 {
 	layout_entry_t entry;
 
+	/*
+	 * compiled layouts are shared, thus immutable: each one is an empty
+	 * proxy, whose own metatable (hidden from Lua) holds the table of its
+	 * fields; which, in turn, holds its header
+	 */
+	lua_newtable(L);
+	lua_createtable(L, 0, 4);
+
+	lua_newtable(L);
+	layout_t *layout = (layout_t *) lua_newuserdata(L, sizeof(layout_t));
+	layout->nfields     = 0;
+	layout->extent      = 0;
+	layout->word_extent = 0;
+	luau_rawsetp(L, -2, &layout_key);
+
 	lua_pushnil(L);  /* first key */
 	while (lua_next(L, index) != 0) {
 		/* uses 'key' (at index -2) and 'value' (at index -1) */
 		load_entry(L, &entry);
-		if (entry.length == 0)
-			lua_pushnil(L);
+		if (entry.length > 0) {
+			/* fields[ key ] = entry */
+			lua_pushvalue(L, -2);
+			new_entry(L, &entry, layout);
+			lua_rawset(L, -5);
+			layout->nfields++;
+			extend_layout(layout, &entry);
+		}
+
+		/* removes 'value'; keeps 'key' for next iteration */
+		lua_pop(L, 1);
+	}
+
+	/* fields shadow the layout methods */
+	luau_setmetatable(L, LAYOUT_METATABLE);
+	lua_pushvalue(L, -1);
+	luau_rawsetp(L, -3, &layout_key);
+	lua_setfield(L, -2, "__index");
+
+	lua_pushcfunction(L, modify_layout);
+	lua_setfield(L, -2, "__newindex");
+	lua_pushboolean(L, false);
+	lua_setfield(L, -2, "__metatable");
+
+	lua_setmetatable(L, -2);
+}
+
+typedef struct {
+	int            key_type;
+	const char    *key;
+	size_t         key_length;
+	lua_Number     number;
+	layout_entry_t entry;
+} field_t;
+
+/*
+ * loads the fields of the spec at index, or returns false if it has too
+ * many fields or keys which are neither strings nor numbers
+ */
+static bool
+load_fields(lua_State *L, int index, field_t *fields, size_t *n)
+{
+	*n = 0;
+
+	lua_pushnil(L);  /* first key */
+	while (lua_next(L, index) != 0) {
+		if (*n == LAYOUT_MAX_FIELDS) {
+			lua_pop(L, 2);
+			return false;
+		}
+
+		field_t *field = &fields[ *n ];
+
+		load_entry(L, &field->entry);
+
+		field->key_type = lua_type(L, -2);
+		lua_pop(L, 1);
+
+		if (field->entry.length == 0)
+			continue;
+
+		/* string keys are anchored by the spec table */
+		if (field->key_type == LUA_TSTRING)
+			field->key = lua_tolstring(L, -1, &field->key_length);
+		else if (field->key_type == LUA_TNUMBER)
+			field->number = lua_tonumber(L, -1);
+		else {
+			lua_pop(L, 1);
+			return false;
+		}
+
+		(*n)++;
+	}
+	return true;
+}
+
+#define FNV_OFFSET	(0xcbf29ce484222325ULL)
+#define FNV_PRIME	(0x100000001b3ULL)
+
+static uint64_t
+hash_bytes(uint64_t hash, const void *bytes, size_t length)
+{
+	const unsigned char *byte = (const unsigned char *) bytes;
+
+	for (size_t i = 0; i < length; i++) {
+		hash ^= byte[ i ];
+		hash *= FNV_PRIME;
+	}
+	return hash;
+}
+
+inline static uint64_t
+hash_word(uint64_t hash, uint64_t word)
+{
+	return (hash ^ word) * FNV_PRIME;
+}
+
+/* hashes the fields of a spec, regardless of their order */
+static uint64_t
+hash_fields(field_t *fields, size_t n)
+{
+	uint64_t hash = n;
+
+	for (size_t i = 0; i < n; i++) {
+		field_t *field = &fields[ i ];
+		uint64_t field_hash = hash_bytes(FNV_OFFSET, &field->key_type,
+			sizeof(int));
+
+		if (field->key_type == LUA_TNUMBER)
+			field_hash = hash_bytes(field_hash, &field->number,
+				sizeof(lua_Number));
 		else
-			new_entry(L, &entry);
+			field_hash = hash_bytes(field_hash, field->key,
+				field->key_length);
+
+		/* the other members of entries are derived from these */
+		layout_entry_t *entry = &field->entry;
+		field_hash = hash_word(field_hash, entry->offset);
+		field_hash = hash_word(field_hash, entry->length);
+		field_hash = hash_word(field_hash, entry->type);
+		hash += hash_word(field_hash, entry->endian);
+	}
+	return hash;
+}
+
+/* checks whether the layout at index has been compiled from such fields */
+static bool
+same_layout(lua_State *L, int index, field_t *fields, size_t n)
+{
+	if (!lua_istable(L, index))
+		return false;
+
+	layout_t *layout = layout_push_fields(L, index);
+	if (layout == NULL)
+		return false;
+
+	bool same = layout->nfields == (lua_Integer) n;
+	for (size_t i = 0; same && i < n; i++) {
+		field_t *field = &fields[ i ];
+
+		if (field->key_type == LUA_TNUMBER)
+			lua_pushnumber(L, field->number);
+		else
+			lua_pushlstring(L, field->key, field->key_length);
+
+		lua_rawget(L, -2);
+		layout_entry_t *entry = (layout_entry_t *) lua_touserdata(L, -1);
+		same = entry != NULL && entry->offset == field->entry.offset &&
+			entry->length == field->entry.length &&
+			entry->type == field->entry.type &&
+			entry->endian == field->entry.endian;
+		lua_pop(L, 1);
+	}
+
+	/* removes fields */
+	lua_pop(L, 1);
+	return same;
+}
+
+inline static void
+get_cache(lua_State *L, const char *name)
+{
+	lua_getfield(L, LUA_REGISTRYINDEX, name);
+}
+
+/*
+ * the identity cache is a direct-mapped array of (spec, layout) pairs, which
+ * keeps recently loaded specs alive, so their addresses are not reused
+ */
+inline static lua_Integer
+identity_slot(lua_State *L, int index)
+{
+	size_t hash = (size_t) lua_topointer(L, index) >> 4;
+	return (lua_Integer) (hash % LAYOUT_IDENTITY_SIZE) * 2 + 1;
+}
+
+void
+layout_load(lua_State *L, int index)
+{
+	if (index < 0)
+		index = lua_gettop(L) + index + 1;
+
+	/* compiled layouts are returned as is */
+	if (layout_get(L, index) != NULL) {
+		lua_pushvalue(L, index);
+		return;
+	}
+
+	/* spec tables which have been loaded recently */
+	get_cache(L, LAYOUT_IDENTITY);
+	lua_Integer slot = identity_slot(L, index);
+	lua_rawgeti(L, -1, slot);
+	if (lua_rawequal(L, -1, index)) {
+		lua_rawgeti(L, -2, slot + 1);
+		/* removes spec and identity cache; keeps layout */
+		lua_replace(L, -3);
+		lua_pop(L, 1);
+		return;
+	}
+	lua_pop(L, 1);
+
+	/* spec tables with the same fields */
+	field_t fields[ LAYOUT_MAX_FIELDS ];
+	size_t  n;
+	if (load_fields(L, index, fields, &n)) {
+		lua_Integer hash = (lua_Integer) hash_fields(fields, n);
+
+		get_cache(L, LAYOUT_CACHE);
+		lua_pushinteger(L, hash);
+		lua_rawget(L, -2);
+		if (!same_layout(L, -1, fields, n)) {
+			lua_pop(L, 1);
+			compile_layout(L, index);
+
+			/* cache[ hash ] = layout */
+			lua_pushinteger(L, hash);
+			lua_pushvalue(L, -2);
+			lua_rawset(L, -4);
+		}
+		/* removes cache; keeps layout */
+		lua_remove(L, -2);
+	}
+	else
+		compile_layout(L, index);
+
+	/* identity[ slot ] = spec; identity[ slot + 1 ] = layout */
+	lua_pushvalue(L, index);
+	lua_rawseti(L, -3, slot);
+	lua_pushvalue(L, -1);
+	lua_rawseti(L, -3, slot + 1);
+
+	/* removes identity cache; keeps layout */
+	lua_remove(L, -2);
+}
+
+static void
+new_cache(lua_State *L, const char *name, const char *mode)
+{
+	lua_newtable(L);
+
+	lua_newtable(L);
+	lua_pushstring(L, mode);
+	lua_setfield(L, -2, "__mode");
+	lua_setmetatable(L, -2);
+
+	lua_setfield(L, LUA_REGISTRYINDEX, name);
+}
+
+int
+layout_endian(const char *endian, int fallback)
+{
+	if (endian[0] == 'n' || endian[0] == 'b')
+		return BIG_ENDIAN;
+	else if (endian[0] == 'l')
+		return LITTLE_ENDIAN;
+	else if (endian[0] == 'h')
+		return BYTE_ORDER;
+	return fallback;
+}
+
+void
+layout_open(lua_State *L)
+{
+	/* compiled layouts are collected once they are no longer used */
+	new_cache(L, LAYOUT_CACHE, "v");
 
-		/* layout[ key ] = entry */
-		luau_settable(L, index, -3, -1);
+	lua_createtable(L, LAYOUT_IDENTITY_SIZE * 2, 0);
+	lua_setfield(L, LUA_REGISTRYINDEX, LAYOUT_IDENTITY);
 
-		/* removes 'value' and 'entry'; keeps 'key' for next iteration */
+	luaL_newmetatable(L, LAYOUT_METATABLE);
+	lua_pushcfunction(L, modify_layout);
+	lua_setfield(L, -2, "__newindex");
+	lua_pop(L, 1);
+
+}
+
+/*
+ * pushes the fields of a compiled layout and returns its header; or returns
+ * NULL, pushing nothing, if it is not one
+ */
+layout_t *
+layout_push_fields(lua_State *L, int index)
+{
+	if (!lua_getmetatable(L, index))
+		return NULL;
+
+	/* only compiled layouts hold the key, which Lua code cannot forge */
+	luau_rawgetp(L, -1, &layout_key);
+	if (!lua_istable(L, -1)) {
 		lua_pop(L, 2);
+		return NULL;
 	}
 
-	lua_pushboolean(L, true);
-	lua_setfield(L, index, LAYOUT_STAMP);
+	/* removes metatable; keeps fields */
+	lua_remove(L, -2);
+	luau_rawgetp(L, -1, &layout_key);
+	layout_t *layout = (layout_t *) lua_touserdata(L, -1);
+	lua_pop(L, 1);
+
+	/* assertion: the header is anchored by the fields */
+	return layout;
 }
 
 layout_entry_t *
 layout_get_entry(lua_State *L, int layout_ix, int key_ix)
 {
-	void *entry = NULL;
+	key_ix = luau_absindex(L, key_ix);
+	if (layout_push_fields(L, layout_ix) == NULL)
+		return NULL;
 
-	luau_getref(L, layout_ix);
-	luau_gettable(L, -1, key_ix);
-	if (lua_isnil(L, -1))
-		goto end;
+	/* fields hold nothing but entries; layout methods are not fields */
+	lua_pushvalue(L, key_ix);
+	lua_rawget(L, -2);
+	layout_entry_t *entry = (layout_entry_t *) lua_touserdata(L, -1);
 
-	entry = test_entry(L, -1);
-
-end:
 	lua_pop(L, 2);
 	return entry;
 }
 
+layout_t *
+layout_get(lua_State *L, int index)
+{
+	layout_t *layout = layout_push_fields(L, index);
+	if (layout != NULL)
+		lua_pop(L, 1);
+	return layout;
+}
@@ -43,25 +43,54 @@
 
 #define LAYOUT_ENTRY_USERDATA 	"data.layout.entry"
 
-#define LAYOUT_STAMP 		"__layout_stamp"
+#define LAYOUT_METATABLE 	"data.layout"
+
+#define LAYOUT_CACHE 		"data.layout.cache"
+#define LAYOUT_IDENTITY 	"data.layout.identity"
+
+#define LAYOUT_IDENTITY_SIZE	(64)
+
+/* specs with more fields are not cached by their fields */
+#define LAYOUT_MAX_FIELDS	(32)
 
 #define LAYOUT_TYPE_DEFAULT	LAYOUT_TNUMBER
 #define LAYOUT_ENDIAN_DEFAULT	BIG_ENDIAN
 
 typedef enum {
 	LAYOUT_TNUMBER = 0,
-	LAYOUT_TSTRING
+	LAYOUT_TSTRING,
+	LAYOUT_TVARINT,
+	LAYOUT_TZIGZAG
 } layout_type_t;
 
+/* header of a compiled layout, held by its metatable */
+typedef struct {
+	lua_Integer nfields;
+	size_t      extent;      /* bytes spanned by its fields */
+	size_t      word_extent; /* bytes spanned by the words of fused fields */
+} layout_t;
+
 typedef struct {
 	size_t        offset;
 	size_t        length;
 	layout_type_t type;
 	int           endian;
+	size_t        word;   /* byte offset of the aligned word holding it */
+	size_t        shift;  /* bits following it within that word */
+	bool          fused;  /* whether it can be extracted from that word */
+	const layout_t *layout; /* compiled layout holding it */
 } layout_entry_t;
 
+void layout_open(lua_State *);
+
 void layout_load(lua_State *, int);
 
+layout_t * layout_push_fields(lua_State *, int);
+
 layout_entry_t * layout_get_entry(lua_State *, int, int);
 
+layout_t * layout_get(lua_State *, int);
+
+int layout_endian(const char *, int);
+
 #endif /* _LAYOUT_H_ */
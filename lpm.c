@@ -0,0 +1,202 @@
+/*
+ * Copyright (c) 2014, Lourival Vieira Neto <lneto@NetBSD.org>.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the Author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#ifndef _KERNEL
+#include <limits.h>
+#include <string.h>
+#include <sys/param.h>
+#else
+#if defined(__NetBSD__)
+#include <machine/limits.h>
+#include <sys/param.h>
+#include <lib/libkern/libkern.h>
+#elif defined(__linux__)
+#include <linux/kernel.h>
+#include <linux/string.h>
+#endif
+#endif
+
+#include <lauxlib.h>
+
+#include "luautil.h"
+
+#include "lpm.h"
+
+#define NODES_SIZE(n)	((n) * sizeof(lpm_node_t))
+
+/* returns the index of a new empty node, growing the nodes as needed */
+static size_t
+new_node(lua_State *L, lpm_t *lpm)
+{
+	if (lpm->nnodes == lpm->capacity) {
+		size_t capacity = lpm->capacity * 2;
+		lpm_node_t *nodes = (lpm_node_t *) luau_malloc(L,
+			NODES_SIZE(capacity));
+		if (nodes == NULL)
+			luaL_error(L, "not enough memory");
+
+		memcpy(nodes, lpm->nodes, NODES_SIZE(lpm->nnodes));
+		luau_free(L, lpm->nodes, NODES_SIZE(lpm->capacity));
+
+		lpm->nodes    = nodes;
+		lpm->capacity = capacity;
+	}
+
+	memset(lpm->nodes[ lpm->nnodes ], 0, sizeof(lpm_node_t));
+	return lpm->nnodes++;
+}
+
+lpm_t *
+lpm_new(lua_State *L)
+{
+	/* the userdata comes first, so errors raised later leak nothing */
+	lpm_t *lpm = (lpm_t *) lua_newuserdata(L, sizeof(lpm_t));
+	lpm->nodes         = NULL;
+	lpm->nnodes        = 0;
+	lpm->capacity      = 0;
+	lpm->nvalues       = 0;
+	lpm->default_value = 0;
+	lpm->shadowed_value = 0;
+
+	luau_setmetatable(L, LPM_USERDATA);
+
+	/* values */
+	lua_newtable(L);
+	luau_setuservalue(L, -2);
+
+	lpm->nodes = (lpm_node_t *) luau_malloc(L,
+		NODES_SIZE(LPM_INITIAL_NODES));
+	if (lpm->nodes == NULL)
+		luaL_error(L, "not enough memory");
+	lpm->capacity = LPM_INITIAL_NODES;
+
+	new_node(L, lpm);  /* root */
+	return lpm;
+}
+
+/*
+ * returns the index for the value of a prefix of length bits, which is the
+ * one it already has if it is inserted again; or 0 if it is too long
+ */
+uint32_t
+lpm_insert(lua_State *L, lpm_t *lpm, const byte_t *prefix, size_t length)
+{
+	if (length > LPM_MAX_BIT || lpm->nvalues == UINT32_MAX)
+		return 0;
+
+	if (length == 0) {
+		if (lpm->default_value == 0)
+			lpm->default_value = ++lpm->nvalues;
+		return lpm->default_value;
+	}
+
+	size_t node  = 0;
+	size_t depth = 0;
+	for (; length - depth > LPM_STRIDE; depth += LPM_STRIDE) {
+		byte_t byte = prefix[ depth / LPM_STRIDE ];
+
+		if (lpm->nodes[ node ][ byte ].child == 0) {
+			/* nodes may be moved */
+			size_t child = new_node(L, lpm);
+			lpm->nodes[ node ][ byte ].child = (uint32_t) child;
+		}
+		node = lpm->nodes[ node ][ byte ].child;
+	}
+
+	/* assertion: 0 < bits <= LPM_STRIDE */
+	size_t bits  = length - depth;
+	byte_t first = prefix[ depth / LPM_STRIDE ] &
+		(byte_t) (UCHAR_MAX << (LPM_STRIDE - bits));
+	size_t count = (size_t) 1 << (LPM_STRIDE - bits);
+
+	/* longer prefixes keep the slots they cover, even the first one */
+	lpm_slot_t *slots = &lpm->nodes[ node ][ first ];
+	bool shadowed = true;
+	for (size_t i = 0; i < count; i++) {
+		if (slots[ i ].length == bits)
+			return slots[ i ].value;
+		if (slots[ i ].length < bits)
+			shadowed = false;
+	}
+
+	/*
+	 * prefixes wholly covered by longer ones are never matched, so they
+	 * share an index instead of taking a new one each time
+	 */
+	if (shadowed) {
+		if (lpm->shadowed_value == 0)
+			lpm->shadowed_value = ++lpm->nvalues;
+		return lpm->shadowed_value;
+	}
+
+	uint32_t value = ++lpm->nvalues;
+	for (size_t i = 0; i < count; i++) {
+		if (slots[ i ].length <= bits) {
+			slots[ i ].value  = value;
+			slots[ i ].length = (uint8_t) bits;
+		}
+	}
+	return value;
+}
+
+/*
+ * returns the index of the value of the longest prefix matching the width
+ * bits of key, or 0 if none does
+ */
+uint32_t
+lpm_lookup(lpm_t *lpm, const byte_t *key, size_t width)
+{
+	uint32_t value = lpm->default_value;
+	size_t   node  = 0;
+
+	width = MIN(width, LPM_MAX_BIT);
+	for (size_t depth = 0; depth < width; depth += LPM_STRIDE) {
+		const lpm_slot_t *slot =
+			&lpm->nodes[ node ][ key[ depth / LPM_STRIDE ] ];
+
+		/* prefixes longer than the key do not match it */
+		if (slot->value != 0 && slot->length <= width - depth)
+			value = slot->value;
+
+		if (slot->child == 0)
+			break;
+		node = slot->child;
+	}
+	return value;
+}
+
+void
+lpm_delete(lua_State *L, lpm_t *lpm)
+{
+	if (lpm->nodes == NULL)
+		return;
+
+	luau_free(L, lpm->nodes, NODES_SIZE(lpm->capacity));
+	lpm->nodes    = NULL;
+	lpm->nnodes   = 0;
+	lpm->capacity = 0;
+}
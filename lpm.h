@@ -0,0 +1,87 @@
+/*
+ * Copyright (c) 2014, Lourival Vieira Neto <lneto@NetBSD.org>.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the Author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#ifndef _LPM_H_
+#define _LPM_H_
+
+#ifndef _KERNEL
+#include <stddef.h>
+#include <stdint.h>
+#else
+#if defined(__NetBSD__)
+#include <sys/types.h>
+#elif defined(__linux__)
+#include <linux/types.h>
+#endif
+#endif
+
+#include <lua.h>
+
+#include "binary.h"
+
+#define LPM_USERDATA	"data.lpm"
+
+/* IPv6 addresses are the widest keys */
+#define LPM_MAX_BIT	(128)
+#define LPM_MAX_BYTE	(LPM_MAX_BIT / BYTE_BIT)
+
+#define LPM_STRIDE	(8)
+#define LPM_FANOUT	(1 << LPM_STRIDE)
+
+#define LPM_INITIAL_NODES	(16)
+
+typedef struct {
+	uint32_t value;  /* index of the longest prefix covering it; 0 if none */
+	uint32_t child;  /* index of the node of the next stride; 0 if none */
+	uint8_t  length; /* bits of that prefix lying within the stride */
+} lpm_slot_t;
+
+typedef lpm_slot_t lpm_node_t[ LPM_FANOUT ];
+
+/*
+ * multibit trie with a fixed stride of a byte, where prefixes are expanded to
+ * every slot they cover in the node of their last stride (as in DIR-24-8);
+ * values are indexes into the table held as the user value of its object
+ */
+typedef struct {
+	lpm_node_t *nodes;	/* the first one is the root */
+	size_t      nnodes;
+	size_t      capacity;
+	uint32_t    nvalues;
+	uint32_t    default_value;	/* of the zero-length prefix */
+	uint32_t    shadowed_value;	/* of prefixes covered by longer ones */
+} lpm_t;
+
+lpm_t * lpm_new(lua_State *);
+
+uint32_t lpm_insert(lua_State *, lpm_t *, const byte_t *, size_t);
+
+uint32_t lpm_lookup(lpm_t *, const byte_t *, size_t);
+
+void lpm_delete(lua_State *, lpm_t *);
+
+#endif /* _LPM_H_ */
@@ -27,8 +27,10 @@
  */
 #ifndef _KERNEL
 #include <string.h>
+#include <sys/param.h>
 #else
 #if defined(__NetBSD__)
+#include <sys/param.h>
 #include <lib/libkern/libkern.h>
 #elif defined(__linux__)
 #include <linux/kernel.h>
@@ -43,15 +45,37 @@
 #include "luadata.h"
 #include "data.h"
 #include "layout.h"
+#include "arena.h"
+#include "stats.h"
+#include "decode.h"
+#include "lpm.h"
+#include "map.h"
+#include "codec.h"
+#ifndef _KERNEL
+#include "pool.h"
+#include "ring.h"
+#include "accessor.h"
+#include "io.h"
+#include "capture.h"
+#endif
+
+static char *
+alloc_data(lua_State *L, arena_t *arena, size_t len)
+{
+	if (arena != NULL)
+		return (char *) arena_alloc(arena, len);
+
+	return (char *) handle_alloc(L, len);
+}
 
 static char *
-new_data_num(lua_State *L, size_t *len)
+new_data_num(lua_State *L, int index, arena_t *arena, size_t *len)
 {
-	*len = luau_tosize(L, 1);
+	*len = luau_tosize(L, index);
 	if (*len == 0)
 		return NULL;
 
-	char *data = (char *) luau_malloc(L, *len);
+	char *data = alloc_data(L, arena, *len);
 	if (data == NULL)
 		return NULL;
 
@@ -60,23 +84,23 @@ new_data_num(lua_State *L, size_t *len)
 }
 
 static char *
-new_data_tab(lua_State *L, size_t *len)
+new_data_tab(lua_State *L, int index, arena_t *arena, size_t *len)
 {
 #if LUA_VERSION_NUM >= 502
-	*len = lua_rawlen(L, 1);
+	*len = lua_rawlen(L, index);
 #else
-	*len = lua_objlen(L, 1);
+	*len = lua_objlen(L, index);
 #endif
 	if (*len == 0)
 		return NULL;
 
-	char *data = (char *) luau_malloc(L, *len);
+	char *data = alloc_data(L, arena, *len);
 	if (data == NULL)
 		return NULL;
 
 	size_t i = 0;
 	lua_pushnil(L);  /* first key */
-	while (lua_next(L, 1) != 0 && i < *len) {
+	while (lua_next(L, index) != 0 && i < *len) {
 		/* uses 'key' (at index -2) and 'value' (at index -1) */
 		data[ i++ ] = (char) lua_tointeger(L, -1);
 		/* removes 'value'; keeps 'key' for next iteration */
@@ -86,13 +110,13 @@ new_data_tab(lua_State *L, size_t *len)
 }
 
 static char *
-new_data_str(lua_State *L, size_t *len)
+new_data_str(lua_State *L, int index, arena_t *arena, size_t *len)
 {
-	const char *str = lua_tolstring(L, 1, len);
+	const char *str = lua_tolstring(L, index, len);
 	if (str == NULL || *len == 0)
 		return NULL;
 
-	char *data = (char *) luau_malloc(L, *len);
+	char *data = alloc_data(L, arena, *len);
 	if (data == NULL)
 		return NULL;
 
@@ -101,23 +125,85 @@ new_data_str(lua_State *L, size_t *len)
 }
 
 static int
-new_data(lua_State *L)
+push_new_data(lua_State *L, int index, arena_t *arena)
 {
 	char   *data = NULL;
 	size_t len   = 0;
 
-	int type = lua_type(L, 1);
+	int type = lua_type(L, index);
 	if (type == LUA_TNUMBER)
-		data = new_data_num(L, &len);
+		data = new_data_num(L, index, arena, &len);
 	else if (type == LUA_TTABLE)
-		data = new_data_tab(L, &len);
+		data = new_data_tab(L, index, arena, &len);
 	else if (type == LUA_TSTRING)
-		data = new_data_str(L, &len);
+		data = new_data_str(L, index, arena, &len);
 
 	if (data == NULL || len == 0)
 		return 0;
 
-	data_new(L, (void *) data, len, true);
+	if (arena == NULL)
+		data_new(L, (void *) data, len, true);
+	else if (data_new_arena(L, arena, (void *) data, len) == NULL)
+		return 0;
+
+	return 1;
+}
+
+static int
+new_data(lua_State *L)
+{
+	return push_new_data(L, 1, NULL);
+}
+
+/* decodes a string into a new data object, which owns the decoded bytes */
+static int
+decode_string(lua_State *L, codec_t codec)
+{
+	size_t      len;
+	const char *str = lua_tolstring(L, 1, &len);
+	if (str == NULL)
+		return 0;
+
+	size_t size = codec == CODEC_HEX ? len / 2 :
+		codec_base64_length(str, len);
+	if (size == 0)
+		return 0;
+
+	byte_t *ptr = (byte_t *) handle_alloc(L, size);
+	if (ptr == NULL)
+		return 0;
+
+	bool valid = codec == CODEC_HEX ? codec_hex_decode(ptr, str, len) :
+		codec_base64_decode(ptr, str, len);
+	if (!valid) {
+		luau_free(L, ptr, ALLOC_SIZE(size));
+		return 0;
+	}
+
+	data_new(L, (void *) ptr, size, true);
+	return 1;
+}
+
+static int
+new_data_hex(lua_State *L)
+{
+	return decode_string(L, CODEC_HEX);
+}
+
+static int
+new_data_base64(lua_State *L)
+{
+	return decode_string(L, CODEC_BASE64);
+}
+
+static int
+new_arena(lua_State *L)
+{
+	size_t size = luau_tosize(L, 1);
+	if (size == 0)
+		return 0;
+
+	arena_new(L, size);
 	return 1;
 }
 
@@ -132,7 +218,69 @@ new_layout(lua_State *L)
 }
 
 static int
-new_segment(lua_State *L)
+call_accessor(lua_State *L)
+{
+	data_t *data = data_test(L, 1);
+	if (data == NULL)
+		return 0;
+
+	layout_entry_t *entry  = lua_touserdata(L, lua_upvalueindex(2));
+	layout_t       *layout = lua_touserdata(L, lua_upvalueindex(3));
+
+	if (lua_gettop(L) >= 2) {
+		data_set_entry(L, data, layout, entry, 2);
+		return 0;
+	}
+	return data_get_entry(L, data, layout, entry);
+}
+
+static int
+layout_accessor(lua_State *L)
+{
+	if (!lua_istable(L, 1))
+		return 0;
+
+	layout_t       *layout = layout_get(L, 1);
+	layout_entry_t *entry  = layout_get_entry(L, 1, 2);
+	if (layout == NULL || entry == NULL)
+		return 0;
+
+	/* the layout anchors the entry */
+	lua_pushvalue(L, 1);
+	lua_pushlightuserdata(L, entry);
+	lua_pushlightuserdata(L, layout);
+	lua_pushcclosure(L, call_accessor, 3);
+	return 1;
+}
+
+#ifndef _KERNEL
+static int
+new_accessors(lua_State *L)
+{
+	if (!lua_istable(L, 1))
+		return 0;
+
+	layout_load(L, 1);
+	return accessor_push(L, -1);
+}
+
+static int
+pointer_data(lua_State *L)
+{
+	data_t *data = lua_touserdata(L, 1);
+
+	void *ptr = data_get_ptr(data);
+	if (ptr == NULL)
+		return 0;
+
+	accessor_pushpointer(L, ptr);
+	luau_pushsize(L, data->length);
+	return 2;
+}
+#endif
+
+static int
+segment_data(lua_State *L, bool cow)
 {
 	data_t *data = lua_touserdata(L, 1);
 
@@ -151,31 +299,327 @@ new_segment(lua_State *L)
 			length -= seg_offset;
 	}
 
+	if (cow)
+		return data_new_cow_segment(L, data, offset, length);
+
 	return data_new_segment(L, data, offset, length);
 }
 
+static int
+new_segment(lua_State *L)
+{
+	return segment_data(L, false);
+}
+
+static int
+new_cow_segment(lua_State *L)
+{
+	return segment_data(L, true);
+}
+
 static int
 apply_layout(lua_State *L)
+{
+	if (!lua_istable(L, 2))
+		return 0;
+
+	/* spec tables are compiled first */
+	if (!data_apply_layout(L, 1, 2)) {
+		layout_load(L, 2);
+		data_apply_layout(L, 1, -1);
+	}
+
+	/* return data object */
+	lua_pushvalue(L, 1);
+	return 1;
+}
+
+static int
+unpack_data(lua_State *L)
+{
+	return data_unpack(L, 1, 2, lua_gettop(L));
+}
+
+static int
+decode_data(lua_State *L)
+{
+	data_t *data = lua_touserdata(L, 1);
+	return decode(L, data, 2);
+}
+
+#define TLV_MAX_WIDTH	(sizeof(uint64_t))
+
+static int
+next_tlv(lua_State *L)
+{
+	data_t     *data   = lua_touserdata(L, lua_upvalueindex(1));
+	data_t     *cursor = lua_touserdata(L, lua_upvalueindex(2));
+	data_tlv_t *tlv    = lua_touserdata(L, lua_upvalueindex(3));
+
+	if (data_tlv_next(L, data, cursor, tlv) == 0)
+		return 0;
+
+	/* the same segment is moved to each value */
+	lua_pushvalue(L, lua_upvalueindex(2));
+	return 2;
+}
+
+static int
+tlv_data(lua_State *L)
+{
+	data_t *data = lua_touserdata(L, 1);
+
+	size_t type_width   = luau_tosize(L, 2);
+	size_t length_width = luau_tosize(L, 3);
+	if (type_width > TLV_MAX_WIDTH || length_width > TLV_MAX_WIDTH)
+		return 0;
+
+	int endian = LAYOUT_ENDIAN_DEFAULT;
+	if (lua_isstring(L, 4))
+		endian = layout_endian(lua_tostring(L, 4), endian);
+
+	/* cursor */
+	if (data_new_segment(L, data, data->offset, data->length) == 0)
+		return 0;
+
+	data_tlv_t *tlv = (data_tlv_t *) lua_newuserdata(L,
+		sizeof(data_tlv_t));
+	tlv->position     = 0;
+	tlv->type_width   = type_width;
+	tlv->length_width = length_width;
+	tlv->endian       = endian;
+
+	lua_pushvalue(L, 1);
+	lua_insert(L, -3);
+	lua_pushcclosure(L, next_tlv, 3);
+	return 1;
+}
+
+static size_t
+get_option(lua_State *L, int index, const char *name, size_t fallback)
+{
+	lua_getfield(L, index, name);
+	size_t value = lua_isnumber(L, -1) ? luau_tosize(L, -1) : fallback;
+	lua_pop(L, 1);
+	return value;
+}
+
+static int
+next_frame(lua_State *L)
+{
+	data_t        *data   = lua_touserdata(L, lua_upvalueindex(1));
+	data_t        *cursor = lua_touserdata(L, lua_upvalueindex(2));
+	data_frames_t *frames = lua_touserdata(L, lua_upvalueindex(3));
+
+	if (data_frame_next(data, cursor, frames) == 1) {
+		/* the same segment is moved to each frame */
+		lua_pushvalue(L, lua_upvalueindex(2));
+		return 1;
+	}
+
+	lua_pushnil(L);
+	if (frames->invalid)
+		return 1;
+
+	/* bytes of the incomplete frame, to be carried over */
+	luau_pushsize(L, data->length - MIN(frames->position, data->length));
+	return 2;
+}
+
+static int
+frames_data(lua_State *L)
 {
 	data_t *data = lua_touserdata(L, 1);
 
 	if (!lua_istable(L, 2))
 		return 0;
 
-	lua_getfield(L, 2, LAYOUT_STAMP);
-	bool is_layout = (bool) lua_toboolean(L, -1);
+	size_t len_width = get_option(L, 2, "len_width", 2);
+	if (len_width > TLV_MAX_WIDTH)
+		return 0;
+
+	int endian = LAYOUT_ENDIAN_DEFAULT;
+	lua_getfield(L, 2, "endian");
+	if (lua_isstring(L, -1))
+		endian = layout_endian(lua_tostring(L, -1), endian);
 	lua_pop(L, 1);
 
-	if (!is_layout)
-		layout_load(L, 2);
+	/* cursor */
+	if (data_new_segment(L, data, data->offset, data->length) == 0)
+		return 0;
+
+	data_frames_t *frames = (data_frames_t *) lua_newuserdata(L,
+		sizeof(data_frames_t));
+	frames->position   = 0;
+	frames->len_offset = get_option(L, 2, "len_offset", 0);
+	frames->len_width  = len_width;
+	frames->header_len = get_option(L, 2, "header_len", 0);
+	frames->max_len    = get_option(L, 2, "max_len", SIZE_MAX);
+	frames->endian     = endian;
+	frames->invalid    = false;
+
+	lua_pushvalue(L, 1);
+	lua_insert(L, -3);
+	lua_pushcclosure(L, next_frame, 3);
+	return 1;
+}
+
+/*
+ * reads the optional (i.e., absent or nil) offset and length arguments;
+ * length defaults to the rest
+ */
+static void
+get_range(lua_State *L, data_t *data, size_t *offset, size_t *length)
+{
+	*offset = lua_isnoneornil(L, 2) ? 0 : luau_tosize(L, 2);
+	*length = lua_isnoneornil(L, 3) ? data->length - *offset :
+		luau_tosize(L, 3);
+}
+
+static int
+tostring_data(lua_State *L)
+{
+	data_t *data = lua_touserdata(L, 1);
+
+	size_t offset, length;
+	get_range(L, data, &offset, &length);
+
+	bool shared = (bool) lua_toboolean(L, 4);
+
+	return data_get_string(L, data, offset, length, shared);
+}
+
+static int
+encode_data(lua_State *L, codec_t codec)
+{
+	data_t *data = lua_touserdata(L, 1);
+
+	size_t offset, length;
+	get_range(L, data, &offset, &length);
+
+	return data_encode(L, data, offset, length, codec);
+}
+
+static int
+hex_data(lua_State *L)
+{
+	return encode_data(L, CODEC_HEX);
+}
+
+static int
+base64_data(lua_State *L)
+{
+	return encode_data(L, CODEC_BASE64);
+}
+
+static int
+copy_data(lua_State *L)
+{
+	data_t *src = lua_touserdata(L, 1);
+	data_t *dst = data_test(L, 2);
+	if (dst == NULL)
+		return 0;
+
+	size_t src_offset = 0;
+	size_t dst_offset = 0;
+
+	int nargs = lua_gettop(L);
+	if (nargs >= 3)
+		src_offset = luau_tosize(L, 3);
+	if (nargs >= 4)
+		dst_offset = luau_tosize(L, 4);
+
+	size_t length;
+	if (nargs >= 5)
+		length = luau_tosize(L, 5);
+	else
+		length = MIN(src->length - src_offset, dst->length - dst_offset);
+
+	if (!data_copy(L, dst, dst_offset, src, src_offset, length))
+		return 0;
+
+	/* return destination data object */
+	lua_pushvalue(L, 2);
+	return 1;
+}
+
+static int
+fill_data(lua_State *L)
+{
+	data_t *data = lua_touserdata(L, 1);
+
+	int byte = (int) lua_tointeger(L, 2);
+
+	size_t offset = 0;
+	size_t length = data->length;
 
-	data_apply_layout(L, data, 2);
+	int nargs = lua_gettop(L);
+	if (nargs >= 3) {
+		offset = luau_tosize(L, 3);
+
+		if (nargs >= 4)
+			length = luau_tosize(L, 4);
+		else
+			length -= offset;
+	}
+
+	if (!data_fill(L, data, byte, offset, length))
+		return 0;
 
 	/* return data object */
 	lua_pushvalue(L, 1);
 	return 1;
 }
 
+static int
+compare_data(lua_State *L)
+{
+	data_t *data1 = lua_touserdata(L, 1);
+	data_t *data2 = data_test(L, 2);
+	if (data2 == NULL)
+		return 0;
+
+	lua_pushinteger(L, data_compare(data1, data2));
+	return 1;
+}
+
+static int
+__eq(lua_State *L)
+{
+	data_t *data1 = data_test(L, 1);
+	data_t *data2 = data_test(L, 2);
+
+	bool equal = data1 != NULL && data2 != NULL &&
+		data_compare(data1, data2) == 0;
+
+	lua_pushboolean(L, equal);
+	return 1;
+}
+
+static int
+__lt(lua_State *L)
+{
+	data_t *data1 = data_test(L, 1);
+	data_t *data2 = data_test(L, 2);
+	if (data1 == NULL || data2 == NULL)
+		return luaL_error(L, "attempt to compare data with non-data");
+
+	lua_pushboolean(L, data_compare(data1, data2) < 0);
+	return 1;
+}
+
+static int
+__le(lua_State *L)
+{
+	data_t *data1 = data_test(L, 1);
+	data_t *data2 = data_test(L, 2);
+	if (data1 == NULL || data2 == NULL)
+		return luaL_error(L, "attempt to compare data with non-data");
+
+	lua_pushboolean(L, data_compare(data1, data2) <= 0);
+	return 1;
+}
+
 static int
 __gc(lua_State *L)
 {
@@ -187,8 +631,6 @@ __gc(lua_State *L)
 static int
 __index(lua_State *L)
 {
-	data_t *data = lua_touserdata(L, 1);
-
 	/* try object-oriented access first */
 	luau_getmetatable(L, 1, 2);
 	if (!lua_isnil(L, -1))
@@ -196,21 +638,19 @@ __index(lua_State *L)
 		return 1;
 
 	lua_pop(L, 1);
-	return data_get_field(L, data, 2);
+	return data_get_field(L, 1, 2);
 }
 
 static int
 __newindex(lua_State *L)
 {
-	data_t *data = lua_touserdata(L, 1);
-
 	/* try object-oriented access first */
 	luau_getmetatable(L, 1, 2);
 	if (!lua_isnil(L, -1))
 		/* shouldn't overwrite a method */
 		goto end;
 
-	data_set_field(L, data, 2, 3);
+	data_set_field(L, 1, 2, 3);
 end:
 	lua_pop(L, 1);
 	return 0;
@@ -230,35 +670,635 @@ __tostring(lua_State *L)
 {
 	data_t *data = lua_touserdata(L, 1);
 
-	const char * ptr = (const char *) data_get_ptr(data);
-	lua_pushlstring(L, ptr, data->length);
+	if (data_get_string(L, data, 0, data->length, false) == 0)
+		lua_pushliteral(L, "");
 	return 1;
 }
 
-static const luaL_Reg data_lib[ ] = {
-	{"new"   , new_data},
-	{"layout", new_layout},
-	{NULL    , NULL}
-};
+static int
+arena_new_data(lua_State *L)
+{
+	arena_t **arena = lua_touserdata(L, 1);
+	return push_new_data(L, 2, *arena);
+}
 
-static const luaL_Reg data_m[ ] = {
-	{"layout"    , apply_layout},
-	{"segment"   , new_segment},
-	{"__index"   , __index},
-	{"__newindex", __newindex},
-	{"__gc"      , __gc},
-	{"__len"     , __len},
-	{"__tostring", __tostring},
-	{NULL        , NULL}
-};
+static int
+arena_reset_data(lua_State *L)
+{
+	arena_t **arena = lua_touserdata(L, 1);
+	arena_reset(*arena);
 
-static const luaL_Reg layout_entry_m[ ] = {
-	{NULL, NULL}
+	/* return arena object */
+	lua_pushvalue(L, 1);
+	return 1;
+}
+
+static int
+arena_gc(lua_State *L)
+{
+	arena_t **arena = lua_touserdata(L, 1);
+
+	/* the buffer might have failed to be allocated */
+	if (*arena != NULL)
+		arena_delete(L, *arena);
+	return 0;
+}
+
+static int
+new_lpm(lua_State *L)
+{
+	lpm_new(L);
+	return 1;
+}
+
+static int
+lpm_insert_prefix(lua_State *L)
+{
+	lpm_t *lpm = lua_touserdata(L, 1);
+
+	size_t size;
+	const char *prefix = lua_tolstring(L, 2, &size);
+	size_t length = luau_tosize(L, 3);
+	if (prefix == NULL || length > BYTE_TO_BIT(size) ||
+	    lua_isnoneornil(L, 4))
+		return 0;
+
+	uint32_t index = lpm_insert(L, lpm, (const byte_t *) prefix, length);
+	if (index == 0)
+		return 0;
+
+	/* values[ index ] = value */
+	luau_getuservalue(L, 1);
+	lua_pushvalue(L, 4);
+	lua_rawseti(L, -2, index);
+	lua_pop(L, 1);
+
+	/* return lpm object */
+	lua_pushvalue(L, 1);
+	return 1;
+}
+
+static int
+lpm_lookup_key(lua_State *L)
+{
+	lpm_t *lpm = lua_touserdata(L, 1);
+
+	byte_t        key[ LPM_MAX_BYTE ];
+	const byte_t *bytes = key;
+	size_t        width = 0;
+
+	if (lua_type(L, 2) == LUA_TSTRING) {
+		size_t size;
+		bytes = (const byte_t *) lua_tolstring(L, 2, &size);
+		width = BYTE_TO_BIT(size);
+	}
+	else if (data_test(L, 2) != NULL)
+		/* reads the field straight from the data */
+		width = data_get_bits(L, 2, 3, key, sizeof(key));
+
+	uint32_t index = width > 0 ? lpm_lookup(lpm, bytes, width) : 0;
+	if (index == 0)
+		return 0;
+
+	luau_getuservalue(L, 1);
+	lua_rawgeti(L, -1, index);
+	return 1;
+}
+
+static int
+lpm_gc(lua_State *L)
+{
+	lpm_t *lpm = lua_touserdata(L, 1);
+	lpm_delete(L, lpm);
+	return 0;
+}
+
+static int
+new_map(lua_State *L)
+{
+	if (!lua_istable(L, 1))
+		return 0;
+
+	size_t capacity  = get_option(L, 1, "capacity", 0);
+	size_t slot_size = get_option(L, 1, "slot", 0);
+
+	lua_getfield(L, 1, "layout");
+	lua_getfield(L, 1, "fields");
+	if (!lua_istable(L, -2) || !lua_istable(L, -1))
+		return 0;
+
+	layout_load(L, -2);
+	if (map_new(L, -1, -2, capacity, slot_size) == NULL)
+		return 0;
+	return 1;
+}
+
+static int
+map_get_data(lua_State *L)
+{
+	data_t *data = data_test(L, 2);
+	if (data == NULL)
+		return 0;
+
+	return map_get(L, 1, data);
+}
+
+static int
+map_upsert_data(lua_State *L)
+{
+	data_t *data = data_test(L, 2);
+	if (data == NULL)
+		return 0;
+
+	return map_upsert(L, 1, data, 3);
+}
+
+static int
+map_delete_data(lua_State *L)
+{
+	data_t *data = data_test(L, 2);
+	if (data == NULL)
+		return 0;
+
+	return map_delete(L, 1, data);
+}
+
+static int
+map_len(lua_State *L)
+{
+	map_t *map = lua_touserdata(L, 1);
+	luau_pushsize(L, map->count);
+	return 1;
+}
+
+static int
+map_gc(lua_State *L)
+{
+	map_t *map = lua_touserdata(L, 1);
+	map_free(L, map);
+	return 0;
+}
+
+#ifndef _KERNEL
+static int
+new_ring(lua_State *L)
+{
+	size_t capacity = luau_tosize(L, 1);
+	const char *name = lua_tostring(L, 2);
+
+	if (capacity == 0 || ring_new(L, capacity, name) == NULL)
+		return 0;
+
+	return 1;
+}
+
+static int
+ring_enqueue(lua_State *L)
+{
+	ring_object_t *object = lua_touserdata(L, 1);
+
+	const void *ptr;
+	size_t length;
+
+	data_t *data = data_test(L, 2);
+	if (data != NULL) {
+		ptr    = data_get_ptr(data);
+		length = data->length;
+	}
+	else
+		ptr = lua_tolstring(L, 2, &length);
+
+	if (ptr == NULL)
+		return 0;
+
+	void *record = ring_reserve(object->ring, length);
+	if (record == NULL)
+		return 0;
+
+	memcpy(record, ptr, length);
+	ring_commit(object->ring, length);
+
+	lua_pushboolean(L, true);
+	return 1;
+}
+
+static int
+ring_dequeue_data(lua_State *L)
+{
+	ring_object_t *object = lua_touserdata(L, 1);
+
+	size_t max = 1;
+	if (lua_gettop(L) >= 2)
+		max = luau_tosize(L, 2);
+
+	return ring_dequeue(L, object, max);
+}
+
+static int
+ring_gc(lua_State *L)
+{
+	ring_object_t *object = lua_touserdata(L, 1);
+	ring_delete(L, object);
+	return 0;
+}
+#endif
+
+#ifndef _KERNEL
+/* file descriptor argument; -1 if it is not a number */
+static int
+get_fd(lua_State *L, int index)
+{
+	return lua_isnumber(L, index) ? (int) lua_tointeger(L, index) : -1;
+}
+
+/* file position argument; -1, for the current file offset, if omitted */
+static off_t
+get_position(lua_State *L, int index)
+{
+	return lua_isnumber(L, index) ? (off_t) lua_tointeger(L, index) : -1;
+}
+
+static int
+transfer_data(lua_State *L, io_op_t op)
+{
+	data_t *data = lua_touserdata(L, 1);
+
+	size_t offset = lua_isnumber(L, 3) ? luau_tosize(L, 3) : 0;
+	size_t length = lua_isnumber(L, 4) ? luau_tosize(L, 4) :
+		data->length - offset;
+
+	return io_transfer(L, op, get_fd(L, 2), data, offset, length,
+		get_position(L, 5));
+}
+
+static int
+read_from_data(lua_State *L)
+{
+	return transfer_data(L, IO_READ);
+}
+
+static int
+write_to_data(lua_State *L)
+{
+	return transfer_data(L, IO_WRITE);
+}
+
+static int
+transfer_vector(lua_State *L, io_op_t op)
+{
+	if (!lua_istable(L, 2))
+		return 0;
+
+	return io_vector(L, op, get_fd(L, 1), 2, get_position(L, 3));
+}
+
+static int
+read_vector(lua_State *L)
+{
+	return transfer_vector(L, IO_READ);
+}
+
+static int
+write_vector(lua_State *L)
+{
+	return transfer_vector(L, IO_WRITE);
+}
+
+static int
+new_batch(lua_State *L)
+{
+	size_t entries = luau_tosize(L, 1);
+	bool   uring   = lua_isnoneornil(L, 2) || lua_toboolean(L, 2);
+
+	if (entries == 0 || io_batch_new(L, entries, uring) == NULL)
+		return 0;
+
+	return 1;
+}
+
+static int
+batch_add(lua_State *L, io_op_t op)
+{
+	if (!io_batch_add(L, 1, op, get_fd(L, 2), 3, get_position(L, 4)))
+		return 0;
+
+	lua_settop(L, 1);
+	return 1;
+}
+
+static int
+batch_read(lua_State *L)
+{
+	return batch_add(L, IO_READ);
+}
+
+static int
+batch_write(lua_State *L)
+{
+	return batch_add(L, IO_WRITE);
+}
+
+static int
+batch_submit(lua_State *L)
+{
+	return io_batch_submit(L, 1);
+}
+
+static int
+batch_uring(lua_State *L)
+{
+	io_batch_t *batch = lua_touserdata(L, 1);
+	lua_pushboolean(L, io_batch_uring(batch));
+	return 1;
+}
+
+static int
+batch_gc(lua_State *L)
+{
+	io_batch_t *batch = lua_touserdata(L, 1);
+	io_batch_delete(batch);
+	return 0;
+}
+#endif
+
+#ifndef _KERNEL
+static int
+next_packet(lua_State *L)
+{
+	data_t          *data   = lua_touserdata(L, lua_upvalueindex(1));
+	data_t          *cursor = lua_touserdata(L, lua_upvalueindex(2));
+	capture_state_t *state  = lua_touserdata(L, lua_upvalueindex(3));
+
+	capture_packet_t packet;
+	if (capture_next(data, cursor, state, &packet) == 0)
+		return 0;
+
+	/* the same segment is moved to each packet */
+	lua_pushvalue(L, lua_upvalueindex(2));
+	lua_pushinteger(L, (lua_Integer) packet.seconds);
+	lua_pushinteger(L, (lua_Integer) packet.nanoseconds);
+	lua_pushinteger(L, (lua_Integer) packet.length);
+	lua_pushinteger(L, (lua_Integer) packet.linktype);
+	return 5;
+}
+
+static int
+open_capture(lua_State *L)
+{
+	const char *path = lua_tostring(L, 1);
+	if (path == NULL || capture_open(L, path) == NULL)
+		return 0;
+
+	return 1;
+}
+
+static int
+capture_packets(lua_State *L)
+{
+	capture_t *capture = lua_touserdata(L, 1);
+	if (capture->handle == NULL)
+		return 0;
+
+	luau_getuservalue(L, 1);
+	lua_rawgeti(L, -1, 1);
+	data_t *data = lua_touserdata(L, -1);
+
+	/* cursor */
+	if (data_new_segment(L, data, data->offset, data->length) == 0)
+		return 0;
+
+	capture_state_t *state = (capture_state_t *) lua_newuserdata(L,
+		sizeof(capture_state_t));
+	capture_init(capture, state);
+
+	lua_pushcclosure(L, next_packet, 3);
+	return 1;
+}
+
+static int
+capture_gc(lua_State *L)
+{
+	capture_t *capture = lua_touserdata(L, 1);
+	capture_close(L, capture);
+	return 0;
+}
+
+static int
+new_capture_writer(lua_State *L)
+{
+	const char *path = lua_tostring(L, 1);
+	uint32_t linktype = lua_isnumber(L, 2) ?
+		(uint32_t) lua_tointeger(L, 2) : CAPTURE_LINKTYPE_ETHERNET;
+
+	if (path == NULL || capture_writer_open(L, path, linktype) == NULL)
+		return 0;
+
+	return 1;
+}
+
+static int
+capture_write_data(lua_State *L)
+{
+	capture_writer_t *writer = lua_touserdata(L, 1);
+
+	const void *ptr;
+	size_t length;
+
+	data_t *data = data_test(L, 2);
+	if (data != NULL) {
+		ptr    = data_get_ptr(data);
+		length = data->length;
+	}
+	else
+		ptr = lua_tolstring(L, 2, &length);
+
+	if (ptr == NULL)
+		return 0;
+
+	/* timestamps default to the current time */
+	capture_packet_t packet;
+	if (lua_isnumber(L, 3)) {
+		packet.seconds     = (uint64_t) lua_tointeger(L, 3);
+		packet.nanoseconds = (uint32_t) lua_tointeger(L, 4);
+	}
+	else
+		capture_timestamp(&packet);
+	packet.length = lua_isnumber(L, 5) ? (uint32_t) lua_tointeger(L, 5) :
+		(uint32_t) length;
+
+	if (!capture_write(writer, (const byte_t *) ptr, length, &packet))
+		return 0;
+
+	lua_pushboolean(L, true);
+	return 1;
+}
+
+static int
+capture_flush_data(lua_State *L)
+{
+	capture_writer_t *writer = lua_touserdata(L, 1);
+	if (!capture_flush(writer))
+		return 0;
+
+	lua_pushboolean(L, true);
+	return 1;
+}
+
+static int
+capture_writer_gc(lua_State *L)
+{
+	capture_writer_t *writer = lua_touserdata(L, 1);
+	capture_writer_close(writer);
+	return 0;
+}
+#endif
+
+static int
+get_stats(lua_State *L)
+{
+	return stats_push(L);
+}
+
+static const luaL_Reg data_lib[ ] = {
+	{"new"        , new_data},
+	{"fromhex"    , new_data_hex},
+	{"frombase64" , new_data_base64},
+	{"layout"     , new_layout},
+#ifndef _KERNEL
+	{"accessors"  , new_accessors},
+#endif
+	{"arena"      , new_arena},
+	{"lpm"        , new_lpm},
+	{"map"        , new_map},
+#ifndef _KERNEL
+	{"ring"       , new_ring},
+	{"readv"      , read_vector},
+	{"writev"     , write_vector},
+	{"batch"      , new_batch},
+	{"pcap_open"  , open_capture},
+	{"pcap_writer", new_capture_writer},
+#endif
+	{"stats"      , get_stats},
+	{NULL         , NULL}
+};
+
+static const luaL_Reg data_m[ ] = {
+	{"layout"     , apply_layout},
+	{"segment"    , new_segment},
+	{"cow_segment", new_cow_segment},
+	{"unpack"     , unpack_data},
+	{"decode"     , decode_data},
+	{"tlv"        , tlv_data},
+	{"frames"     , frames_data},
+#ifndef _KERNEL
+	{"pointer"    , pointer_data},
+#endif
+	{"copy"       , copy_data},
+	{"fill"       , fill_data},
+	{"compare"    , compare_data},
+	{"tostring"   , tostring_data},
+	{"hex"        , hex_data},
+	{"base64"     , base64_data},
+#ifndef _KERNEL
+	{"read_from"  , read_from_data},
+	{"write_to"   , write_to_data},
+#endif
+	{"__index"    , __index},
+	{"__newindex" , __newindex},
+	{"__gc"       , __gc},
+	{"__len"      , __len},
+	{"__tostring" , __tostring},
+	{"__eq"       , __eq},
+	{"__lt"       , __lt},
+	{"__le"       , __le},
+	{NULL         , NULL}
+};
+
+static const luaL_Reg arena_m[ ] = {
+	{"new"  , arena_new_data},
+	{"reset", arena_reset_data},
+	{"__gc" , arena_gc},
+	{NULL   , NULL}
+};
+
+static const luaL_Reg lpm_m[ ] = {
+	{"insert", lpm_insert_prefix},
+	{"lookup", lpm_lookup_key},
+	{"__gc"  , lpm_gc},
+	{NULL    , NULL}
+};
+
+static const luaL_Reg map_m[ ] = {
+	{"get"   , map_get_data},
+	{"upsert", map_upsert_data},
+	{"delete", map_delete_data},
+	{"__len" , map_len},
+	{"__gc"  , map_gc},
+	{NULL    , NULL}
+};
+
+#ifndef _KERNEL
+static const luaL_Reg ring_m[ ] = {
+	{"enqueue", ring_enqueue},
+	{"dequeue", ring_dequeue_data},
+	{"__gc"   , ring_gc},
+	{NULL     , NULL}
+};
+
+static const luaL_Reg batch_m[ ] = {
+	{"read"  , batch_read},
+	{"write" , batch_write},
+	{"submit", batch_submit},
+	{"uring" , batch_uring},
+	{"__gc"  , batch_gc},
+	{NULL    , NULL}
+};
+
+static const luaL_Reg capture_m[ ] = {
+	{"packets", capture_packets},
+	{"close"  , capture_gc},
+	{"__gc"   , capture_gc},
+	{NULL     , NULL}
+};
+
+static const luaL_Reg capture_writer_m[ ] = {
+	{"write", capture_write_data},
+	{"flush", capture_flush_data},
+	{"close", capture_writer_gc},
+	{"__gc" , capture_writer_gc},
+	{NULL   , NULL}
+};
+#endif
+
+static const luaL_Reg layout_m[ ] = {
+	{"accessor", layout_accessor},
+	{NULL      , NULL}
+};
+
+static const luaL_Reg layout_entry_m[ ] = {
+	{NULL, NULL}
 };
 
 int
 luaopen_data(lua_State *L)
 {
+	stats_open(L);
+	layout_open(L);
+#ifndef _KERNEL
+	accessor_open(L);
+#endif
+
+	/* compiled layouts have methods, shadowed by fields of the same name */
+	luaL_getmetatable(L, LAYOUT_METATABLE);
+	lua_newtable(L);
+#if LUA_VERSION_NUM >= 502
+	luaL_setfuncs(L, layout_m, 0);
+#else
+	luaL_register(L, NULL, layout_m);
+#endif
+	lua_setfield(L, -2, "__index");
+	lua_pop(L, 1);
+
 	luaL_newmetatable(L, LAYOUT_ENTRY_USERDATA);
 #if LUA_VERSION_NUM >= 502
 	luaL_setfuncs(L, layout_entry_m, 0);
@@ -267,6 +1307,81 @@ luaopen_data(lua_State *L)
 #endif
 	lua_pop(L, 1);
 
+	/* layouts are compiled once their entries have a metatable */
+	decode_open(L);
+
+	luaL_newmetatable(L, ARENA_USERDATA);
+#if LUA_VERSION_NUM >= 502
+	luaL_setfuncs(L, arena_m, 0);
+#else
+	luaL_register(L, NULL, arena_m);
+#endif
+	lua_pushvalue(L, -1);
+	lua_setfield(L, -2, "__index");
+	lua_pop(L, 1);
+
+	luaL_newmetatable(L, LPM_USERDATA);
+#if LUA_VERSION_NUM >= 502
+	luaL_setfuncs(L, lpm_m, 0);
+#else
+	luaL_register(L, NULL, lpm_m);
+#endif
+	lua_pushvalue(L, -1);
+	lua_setfield(L, -2, "__index");
+	lua_pop(L, 1);
+
+	luaL_newmetatable(L, MAP_USERDATA);
+#if LUA_VERSION_NUM >= 502
+	luaL_setfuncs(L, map_m, 0);
+#else
+	luaL_register(L, NULL, map_m);
+#endif
+	lua_pushvalue(L, -1);
+	lua_setfield(L, -2, "__index");
+	lua_pop(L, 1);
+
+#ifndef _KERNEL
+	luaL_newmetatable(L, RING_USERDATA);
+#if LUA_VERSION_NUM >= 502
+	luaL_setfuncs(L, ring_m, 0);
+#else
+	luaL_register(L, NULL, ring_m);
+#endif
+	lua_pushvalue(L, -1);
+	lua_setfield(L, -2, "__index");
+	lua_pop(L, 1);
+
+	luaL_newmetatable(L, IO_BATCH_USERDATA);
+#if LUA_VERSION_NUM >= 502
+	luaL_setfuncs(L, batch_m, 0);
+#else
+	luaL_register(L, NULL, batch_m);
+#endif
+	lua_pushvalue(L, -1);
+	lua_setfield(L, -2, "__index");
+	lua_pop(L, 1);
+
+	luaL_newmetatable(L, CAPTURE_USERDATA);
+#if LUA_VERSION_NUM >= 502
+	luaL_setfuncs(L, capture_m, 0);
+#else
+	luaL_register(L, NULL, capture_m);
+#endif
+	lua_pushvalue(L, -1);
+	lua_setfield(L, -2, "__index");
+	lua_pop(L, 1);
+
+	luaL_newmetatable(L, CAPTURE_WRITER_USERDATA);
+#if LUA_VERSION_NUM >= 502
+	luaL_setfuncs(L, capture_writer_m, 0);
+#else
+	luaL_register(L, NULL, capture_writer_m);
+#endif
+	lua_pushvalue(L, -1);
+	lua_setfield(L, -2, "__index");
+	lua_pop(L, 1);
+#endif
+
 	luaL_newmetatable(L, DATA_USERDATA);
 #if LUA_VERSION_NUM >= 502
 	luaL_setfuncs(L, data_m, 0);
@@ -276,6 +1391,22 @@ luaopen_data(lua_State *L)
 	luaL_register(L, DATA_LIB, data_lib);
 #endif
 
+	/*
+	 * layouts of the headers walked by decode(); a copy, so assigning
+	 * to it does not change what decode() applies
+	 */
+	lua_getfield(L, LUA_REGISTRYINDEX, DECODE_LAYOUTS);
+	lua_newtable(L);
+	lua_pushnil(L);  /* first key */
+	while (lua_next(L, -3) != 0) {
+		/* copy[ key ] = layout */
+		lua_pushvalue(L, -2);
+		lua_insert(L, -2);
+		lua_rawset(L, -4);
+	}
+	lua_setfield(L, -3, "layouts");
+	lua_pop(L, 1);
+
 	return 1;
 }
 
@@ -317,6 +1448,45 @@ ldata_unref(lua_State *L, int r)
 	luau_unref(L, r);
 }
 
+int
+ldata_newarena(lua_State *L, size_t size)
+{
+	arena_new(L, size);
+	/* keep the new arena object on the stack */
+	lua_pushvalue(L, -1);
+	return luau_ref(L);
+}
+
+void
+ldata_resetarena(lua_State *L, int r)
+{
+	luau_getref(L, r);
+
+	arena_t *arena = arena_test(L, -1);
+	if (arena != NULL)
+		arena_reset(arena);
+
+	/* pop arena object */
+	lua_pop(L, 1);
+}
+
+void
+ldata_unrefarena(lua_State *L, int r)
+{
+	ldata_resetarena(L, r);
+	luau_unref(L, r);
+}
+
+int
+ldata_decode(lua_State *L, int index)
+{
+	data_t *data = data_test(L, index);
+	if (data == NULL)
+		return 0;
+
+	return decode(L, data, 0);
+}
+
 void *
 ldata_topointer(lua_State *L, int index, size_t *size)
 {
@@ -333,6 +1503,82 @@ ldata_topointer(lua_State *L, int index, size_t *size)
 	return data_get_ptr(data);
 }
 
+#ifndef _KERNEL
+void *
+ldata_export(lua_State *L, int index)
+{
+	data_t *data = data_test(L, index);
+	if (data == NULL)
+		return NULL;
+
+	return data_export(L, data);
+}
+
+int
+ldata_import(lua_State *L, void *token, int writer)
+{
+	if (data_import(L, (shared_token_t *) token, (bool) writer) == NULL)
+		return 0;
+
+	/* keep the new data object on the stack */
+	return 1;
+}
+
+void
+ldata_release(void *token)
+{
+	shared_token_delete((shared_token_t *) token);
+}
+
+ldata_pool_t *
+ldata_pool_create(size_t nthreads, const char *script, const char *function)
+{
+	return pool_create(nthreads, script, function);
+}
+
+int
+ldata_pool_submit(ldata_pool_t *pool, void *ptr, size_t size,
+	ldata_callback_t callback, void *arg)
+{
+	return pool_submit(pool, ptr, size, callback, arg);
+}
+
+void
+ldata_pool_destroy(ldata_pool_t *pool)
+{
+	pool_destroy(pool);
+}
+
+ldata_ring_t *
+ldata_toring(lua_State *L, int index)
+{
+	return ring_test(L, index);
+}
+
+void *
+ldata_ring_reserve(ldata_ring_t *ring, size_t size)
+{
+	return ring_reserve(ring, size);
+}
+
+void
+ldata_ring_commit(ldata_ring_t *ring, size_t size)
+{
+	ring_commit(ring, size);
+}
+#endif
+
+const ldata_stats_t *
+ldata_stats(lua_State *L)
+{
+#ifdef DATA_STATS
+	stats_t *stats = stats_get(L);
+	if (stats != NULL)
+		return &stats->counters;
+#endif
+	return NULL;
+}
+
 #if defined(_KERNEL) && defined(_MODULE)
 #if defined(__NetBSD__) 
 #include <sys/lua.h>
@@ -363,7 +1609,12 @@ luadata_modcmd(modcmd_t cmd, void *opaque)
 EXPORT_SYMBOL(luaopen_data);
 EXPORT_SYMBOL(ldata_newref);
 EXPORT_SYMBOL(ldata_unref);
+EXPORT_SYMBOL(ldata_newarena);
+EXPORT_SYMBOL(ldata_resetarena);
+EXPORT_SYMBOL(ldata_unrefarena);
+EXPORT_SYMBOL(ldata_decode);
 EXPORT_SYMBOL(ldata_topointer);
+EXPORT_SYMBOL(ldata_stats);
 
 static int __init data_init(void)
 {
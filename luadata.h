@@ -41,6 +41,22 @@
 
 #include <lua.h>
 
+typedef struct {
+	size_t data;		/* live data objects */
+	size_t segments;	/* live segments */
+	size_t handles;		/* live handles */
+	size_t bytes;		/* bytes owned by live handles */
+	size_t allocs;		/* data objects created */
+	size_t frees;		/* data objects collected */
+	size_t number_reads;
+	size_t number_writes;
+	size_t string_reads;
+	size_t string_writes;
+	size_t misses;		/* field accesses out of bounds */
+	size_t pulldowns;	/* m_pulldown() calls */
+	size_t copies;		/* copy-on-write copies */
+} ldata_stats_t;
+
 extern int luaopen_data(lua_State *);
 
 extern int ldata_newref(lua_State *, void *, size_t);
@@ -51,6 +67,43 @@ extern int ldata_newref_chain(lua_State *, struct mbuf *);
 
 extern void ldata_unref(lua_State *, int);
 
+extern int ldata_newarena(lua_State *, size_t);
+
+extern void ldata_resetarena(lua_State *, int);
+
+extern void ldata_unrefarena(lua_State *, int);
+
 extern void * ldata_topointer(lua_State *, int, size_t *);
 
+extern int ldata_decode(lua_State *, int);
+
+#ifndef _KERNEL
+extern void * ldata_export(lua_State *, int);
+
+extern int ldata_import(lua_State *, void *, int);
+
+extern void ldata_release(void *);
+
+typedef struct pool ldata_pool_t;
+
+typedef void (*ldata_callback_t)(void *, size_t, int, void *);
+
+extern ldata_pool_t * ldata_pool_create(size_t, const char *, const char *);
+
+extern int ldata_pool_submit(ldata_pool_t *, void *, size_t, ldata_callback_t,
+	void *);
+
+extern void ldata_pool_destroy(ldata_pool_t *);
+
+typedef struct ring ldata_ring_t;
+
+extern ldata_ring_t * ldata_toring(lua_State *, int);
+
+extern void * ldata_ring_reserve(ldata_ring_t *, size_t);
+
+extern void ldata_ring_commit(ldata_ring_t *, size_t);
+#endif
+
+extern const ldata_stats_t * ldata_stats(lua_State *);
+
 #endif /* _LUA_DATA_H_ */
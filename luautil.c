@@ -86,6 +86,26 @@ luau_setmetatable(lua_State *L, const char *tname)
 	lua_setmetatable(L, -2);
 }
 
+/* as luaL_testudata(), which is missing in Lua 5.1 */
+void *
+luau_testudata(lua_State *L, int index, const char *tname)
+{
+#if LUA_VERSION_NUM >= 502
+	return luaL_testudata(L, index, tname);
+#else
+	void *ud = lua_touserdata(L, index);
+	if (ud == NULL || !lua_getmetatable(L, index))
+		return NULL;
+
+	luaL_getmetatable(L, tname);
+	if (!lua_rawequal(L, -1, -2))
+		ud = NULL;
+
+	lua_pop(L, 2);
+	return ud;
+#endif
+}
+
 void *
 luau_malloc(lua_State *L, size_t size)
 {
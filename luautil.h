@@ -41,6 +41,37 @@
 #define luau_unref(L, r)	luaL_unref(L, LUA_REGISTRYINDEX, r)
 #define luau_getref(L, r)	lua_rawgeti(L, LUA_REGISTRYINDEX, r)
 
+#define luau_absindex(L, index) \
+	((index) > 0 || (index) <= LUA_REGISTRYINDEX ? (index) : \
+		lua_gettop(L) + (index) + 1)
+
+/* userdata values are environments on Lua 5.1 */
+#if LUA_VERSION_NUM >= 504
+#define luau_getuservalue(L, index)	lua_getiuservalue(L, index, 1)
+#define luau_setuservalue(L, index)	lua_setiuservalue(L, index, 1)
+#elif LUA_VERSION_NUM >= 502
+#define luau_getuservalue(L, index)	lua_getuservalue(L, index)
+#define luau_setuservalue(L, index)	lua_setuservalue(L, index)
+#else
+#define luau_getuservalue(L, index)	lua_getfenv(L, index)
+#define luau_setuservalue(L, index)	lua_setfenv(L, index)
+#endif
+
+/* tables keyed by the address of a C object, which Lua cannot forge */
+#if LUA_VERSION_NUM >= 502
+#define luau_rawgetp(L, index, p)	lua_rawgetp(L, index, p)
+#define luau_rawsetp(L, index, p)	lua_rawsetp(L, index, p)
+#else
+#define luau_relindex(index) \
+	((index) < 0 && (index) > LUA_REGISTRYINDEX ? (index) - 1 : (index))
+#define luau_rawgetp(L, index, p) \
+	(lua_pushlightuserdata(L, (void *) (p)), \
+	 lua_rawget(L, luau_relindex(index)))
+#define luau_rawsetp(L, index, p) \
+	(lua_pushlightuserdata(L, (void *) (p)), lua_insert(L, -2), \
+	 lua_rawset(L, luau_relindex(index)))
+#endif
+
 #define luau_tosize(L, index)	((size_t) lua_tointeger(L, index))
 #define luau_pushsize(L, size)	lua_pushinteger(L, (lua_Integer) size)
 
@@ -56,6 +87,8 @@ void luau_getmetatable(lua_State *, int, int);
 
 void luau_setmetatable(lua_State *, const char *);
 
+void * luau_testudata(lua_State *, int, const char *);
+
 void * luau_malloc(lua_State *, size_t);
 
 void luau_free(lua_State *, void *, size_t);
@@ -0,0 +1,434 @@
+/*
+ * Copyright (c) 2014, Lourival Vieira Neto <lneto@NetBSD.org>.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the Author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#ifndef _KERNEL
+#include <limits.h>
+#include <string.h>
+#else
+#if defined(__NetBSD__)
+#include <machine/limits.h>
+#include <lib/libkern/libkern.h>
+#elif defined(__linux__)
+#include <linux/string.h>
+#endif
+#endif
+
+#include <lauxlib.h>
+
+#include "luautil.h"
+
+#include "map.h"
+
+#define MAP_VALUES_SIZE(map) \
+	((map)->capacity * sizeof(map_entry_t) + \
+	 ((map)->mask + 1) * sizeof(uint32_t) + \
+	 (map)->capacity * (map)->key_size)
+
+#define KEY(map, index)		((map)->keys + (size_t) (index) * (map)->key_size)
+#define HOME(map, hash)		((size_t) (hash) & (map)->mask)
+
+#define FNV_OFFSET	UINT64_C(0xcbf29ce484222325)
+#define FNV_PRIME	UINT64_C(0x100000001b3)
+
+static uint32_t
+hash_key(const byte_t *key, size_t size)
+{
+	uint64_t hash = FNV_OFFSET;
+
+	for (size_t i = 0; i < size; i++) {
+		hash ^= key[ i ];
+		hash *= FNV_PRIME;
+	}
+	return (uint32_t) (hash ^ hash >> 32);
+}
+
+/* copies the fields of data making up a key; false if any is missing */
+static bool
+get_key(map_t *map, data_t *data, byte_t *key)
+{
+	for (size_t i = 0; i < map->nfields; i++) {
+		if (data_get_entry_bits(data, map->layout, map->fields[ i ],
+			key, map->sizes[ i ]) == 0)
+			return false;
+		key += map->sizes[ i ];
+	}
+	return true;
+}
+
+/* returns the entry of a key and its bucket, or MAP_NONE and an empty one */
+static uint32_t
+find_key(map_t *map, const byte_t *key, uint32_t hash, size_t *bucket)
+{
+	size_t i = HOME(map, hash);
+
+	for (; map->buckets[ i ] != 0; i = (i + 1) & map->mask) {
+		uint32_t index = map->buckets[ i ] - 1;
+		if (map->entries[ index ].hash == hash &&
+		    memcmp(KEY(map, index), key, map->key_size) == 0) {
+			*bucket = i;
+			return index;
+		}
+	}
+	*bucket = i;
+	return MAP_NONE;
+}
+
+static size_t
+find_bucket(map_t *map, uint32_t index)
+{
+	size_t i = HOME(map, map->entries[ index ].hash);
+
+	while (map->buckets[ i ] != index + 1)
+		i = (i + 1) & map->mask;
+	return i;
+}
+
+/* empties a bucket, shifting back the ones probed past it */
+static void
+remove_bucket(map_t *map, size_t i)
+{
+	for (size_t j = (i + 1) & map->mask; map->buckets[ j ] != 0;
+	     j = (j + 1) & map->mask) {
+		uint32_t index = map->buckets[ j ] - 1;
+		size_t   home  = HOME(map, map->entries[ index ].hash);
+
+		/* whether home lies cyclically in (i, j] */
+		bool stays = i <= j ? (home > i && home <= j) :
+			(home > i || home <= j);
+		if (!stays) {
+			map->buckets[ i ] = map->buckets[ j ];
+			i = j;
+		}
+	}
+	map->buckets[ i ] = 0;
+}
+
+static void
+unlink_entry(map_t *map, uint32_t index)
+{
+	map_entry_t *entry = &map->entries[ index ];
+
+	if (entry->prev != MAP_NONE)
+		map->entries[ entry->prev ].next = entry->next;
+	else
+		map->head = entry->next;
+
+	if (entry->next != MAP_NONE)
+		map->entries[ entry->next ].prev = entry->prev;
+	else
+		map->tail = entry->prev;
+}
+
+static void
+push_entry(map_t *map, uint32_t index)
+{
+	map_entry_t *entry = &map->entries[ index ];
+
+	entry->prev = MAP_NONE;
+	entry->next = map->head;
+	if (map->head != MAP_NONE)
+		map->entries[ map->head ].prev = index;
+	else
+		map->tail = index;
+	map->head = index;
+}
+
+/* sets the value of an entry to the one on the top, which is popped */
+static void
+set_value(lua_State *L, int map_ix, uint32_t index)
+{
+	luau_getuservalue(L, map_ix);
+	lua_insert(L, -2);
+	lua_rawseti(L, -2, index + 1);
+	lua_pop(L, 1);
+}
+
+static void
+remove_entry(lua_State *L, int map_ix, map_t *map, uint32_t index,
+	size_t bucket)
+{
+	remove_bucket(map, bucket);
+	unlink_entry(map, index);
+
+	map->entries[ index ].next = map->unused;
+	map->unused = index;
+	map->count--;
+
+	if (map->slots == NULL) {
+		lua_pushnil(L);
+		set_value(L, map_ix, index);
+	}
+}
+
+static int
+push_value(lua_State *L, int map_ix, map_t *map, uint32_t index)
+{
+	luau_getuservalue(L, map_ix);
+	if (map->slots == NULL)
+		lua_rawgeti(L, -1, index + 1);
+	else {
+		if (!data_move_segment(map->cursor, map->slots,
+			index * map->slot_size, map->slot_size)) {
+			lua_pop(L, 1);
+			return 0;
+		}
+		lua_getfield(L, -1, "cursor");
+	}
+	lua_remove(L, -2);
+	return 1;
+}
+
+static bool
+load_fields(lua_State *L, map_t *map, int layout_ix, int fields_ix)
+{
+#if LUA_VERSION_NUM >= 502
+	size_t nfields = lua_rawlen(L, fields_ix);
+#else
+	size_t nfields = lua_objlen(L, fields_ix);
+#endif
+	if (nfields == 0 || nfields > MAP_MAX_FIELDS)
+		return false;
+
+	map->nfields  = nfields;
+	map->key_size = 0;
+	for (size_t i = 0; i < nfields; i++) {
+		lua_rawgeti(L, fields_ix, i + 1);
+		layout_entry_t *entry = layout_get_entry(L, layout_ix, -1);
+		lua_pop(L, 1);
+
+		/* fields are read as by data_get_entry_bits() */
+		if (entry == NULL || (entry->type != LAYOUT_TNUMBER &&
+		    entry->type != LAYOUT_TSTRING))
+			return false;
+
+		map->fields[ i ] = entry;
+		map->sizes[ i ]  = entry->type == LAYOUT_TNUMBER ?
+			BIT_TO_BYTE(entry->length) : entry->length;
+		map->key_size   += map->sizes[ i ];
+	}
+	return map->key_size <= MAP_MAX_KEY;
+}
+
+static bool
+new_slots(lua_State *L, map_t *map)
+{
+	size_t size = map->capacity * map->slot_size;
+
+	void *ptr = handle_alloc(L, size);
+	if (ptr == NULL)
+		return false;
+	memset(ptr, 0, size);
+
+	map->slots = data_new(L, ptr, size, true);
+	lua_setfield(L, -2, "slots");
+
+	data_new_segment(L, map->slots, map->slots->offset, map->slot_size);
+	map->cursor = (data_t *) lua_touserdata(L, -1);
+	lua_setfield(L, -2, "cursor");
+	return true;
+}
+
+/*
+ * pushes a map of up to capacity keys made of the given fields of a layout,
+ * whose values are Lua values or, if slot_size is not 0, slots of that size
+ */
+map_t *
+map_new(lua_State *L, int layout_ix, int fields_ix, size_t capacity,
+	size_t slot_size)
+{
+	layout_ix = luau_absindex(L, layout_ix);
+	fields_ix = luau_absindex(L, fields_ix);
+
+	if (capacity == 0 || capacity > MAP_MAX_CAPACITY ||
+	    (slot_size > 0 && capacity > SIZE_MAX / 2 / slot_size))
+		return NULL;
+
+	map_t map;
+	map.layout = layout_get(L, layout_ix);
+	if (map.layout == NULL || !load_fields(L, &map, layout_ix, fields_ix))
+		return NULL;
+
+	/* buckets are kept at most half full */
+	size_t nbuckets = 1;
+	while (nbuckets < capacity * 2)
+		nbuckets <<= 1;
+
+	map.mask      = nbuckets - 1;
+	map.capacity  = capacity;
+	map.count     = 0;
+	map.head      = MAP_NONE;
+	map.tail      = MAP_NONE;
+	map.unused    = 0;
+	map.slot_size = slot_size;
+	map.slots     = NULL;
+	map.cursor    = NULL;
+	map.entries   = NULL;
+
+	/* the userdata comes first, so errors raised later leak nothing */
+	map_t *ud = (map_t *) lua_newuserdata(L, sizeof(map_t));
+	*ud = map;
+	luau_setmetatable(L, MAP_USERDATA);
+
+	ud->entries = (map_entry_t *) luau_malloc(L, MAP_VALUES_SIZE(ud));
+	if (ud->entries == NULL) {
+		lua_pop(L, 1);
+		return NULL;
+	}
+
+	ud->buckets = (uint32_t *) (ud->entries + capacity);
+	ud->keys    = (byte_t *) (ud->buckets + nbuckets);
+	memset(ud->buckets, 0, nbuckets * sizeof(uint32_t));
+
+	for (size_t i = 0; i < capacity; i++)
+		ud->entries[ i ].next = i + 1 < capacity ? i + 1 : MAP_NONE;
+
+	/* values, along with what anchors the fields and slots */
+	lua_createtable(L, slot_size > 0 ? 0 : capacity, 3);
+	lua_pushvalue(L, layout_ix);
+	lua_setfield(L, -2, "layout");
+	if (slot_size > 0 && !new_slots(L, ud)) {
+		lua_pop(L, 2);
+		return NULL;
+	}
+	luau_setuservalue(L, -2);
+	return ud;
+}
+
+/* pushes the value of the key of data and marks it as the most recent */
+int
+map_get(lua_State *L, int map_ix, data_t *data)
+{
+	map_t *map = (map_t *) lua_touserdata(L, map_ix);
+	byte_t key[ MAP_MAX_KEY ];
+	size_t bucket;
+
+	if (!get_key(map, data, key))
+		return 0;
+
+	uint32_t index = find_key(map, key, hash_key(key, map->key_size),
+		&bucket);
+	if (index == MAP_NONE)
+		return 0;
+
+	unlink_entry(map, index);
+	push_entry(map, index);
+	return push_value(L, map_ix, map, index);
+}
+
+/*
+ * pushes the value of the key of data, inserting it first if missing (with
+ * the given value, true or a zeroed slot) and evicting the least recently
+ * used key if full; pushes whether it was inserted as well
+ */
+int
+map_upsert(lua_State *L, int map_ix, data_t *data, int value_ix)
+{
+	map_t *map = (map_t *) lua_touserdata(L, map_ix);
+	byte_t key[ MAP_MAX_KEY ];
+	size_t bucket;
+
+	if (!get_key(map, data, key))
+		return 0;
+
+	uint32_t hash  = hash_key(key, map->key_size);
+	uint32_t index = find_key(map, key, hash, &bucket);
+	bool inserted  = index == MAP_NONE;
+
+	if (inserted) {
+		if (map->unused == MAP_NONE) {
+			uint32_t tail = map->tail;
+			remove_entry(L, map_ix, map, tail,
+				find_bucket(map, tail));
+
+			/* buckets may be shifted */
+			find_key(map, key, hash, &bucket);
+		}
+
+		index = map->unused;
+		map->unused = map->entries[ index ].next;
+		map->count++;
+
+		map->entries[ index ].hash = hash;
+		memcpy(KEY(map, index), key, map->key_size);
+		map->buckets[ bucket ] = index + 1;
+		push_entry(map, index);
+
+		if (map->slots != NULL) {
+			byte_t *slots = (byte_t *) data_get_ptr(map->slots);
+			memset(slots + index * map->slot_size, 0,
+				map->slot_size);
+		}
+		else if (lua_isnoneornil(L, value_ix)) {
+			lua_pushboolean(L, true);
+			set_value(L, map_ix, index);
+		}
+	}
+	else {
+		unlink_entry(map, index);
+		push_entry(map, index);
+	}
+
+	if (map->slots == NULL && !lua_isnoneornil(L, value_ix)) {
+		lua_pushvalue(L, value_ix);
+		set_value(L, map_ix, index);
+	}
+
+	if (push_value(L, map_ix, map, index) == 0)
+		return 0;
+	lua_pushboolean(L, inserted);
+	return 2;
+}
+
+/* removes the key of data, pushing whether it was there */
+int
+map_delete(lua_State *L, int map_ix, data_t *data)
+{
+	map_t *map = (map_t *) lua_touserdata(L, map_ix);
+	byte_t key[ MAP_MAX_KEY ];
+	size_t bucket;
+
+	if (!get_key(map, data, key))
+		return 0;
+
+	uint32_t index = find_key(map, key, hash_key(key, map->key_size),
+		&bucket);
+	if (index != MAP_NONE)
+		remove_entry(L, map_ix, map, index, bucket);
+
+	lua_pushboolean(L, index != MAP_NONE);
+	return 1;
+}
+
+void
+map_free(lua_State *L, map_t *map)
+{
+	if (map->entries == NULL)
+		return;
+
+	luau_free(L, map->entries, MAP_VALUES_SIZE(map));
+	map->entries = NULL;
+}
@@ -0,0 +1,98 @@
+/*
+ * Copyright (c) 2014, Lourival Vieira Neto <lneto@NetBSD.org>.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the Author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#ifndef _MAP_H_
+#define _MAP_H_
+
+#ifndef _KERNEL
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#else
+#if defined(__NetBSD__)
+#include <sys/types.h>
+#elif defined(__linux__)
+#include <linux/types.h>
+#endif
+#endif
+
+#include <lua.h>
+
+#include "data.h"
+#include "layout.h"
+
+#define MAP_USERDATA	"data.map"
+
+#define MAP_MAX_FIELDS		(8)
+#define MAP_MAX_KEY		(64)
+#define MAP_MAX_CAPACITY	((size_t) 1 << 24)
+
+#define MAP_NONE	UINT32_MAX
+
+typedef struct {
+	uint32_t hash;
+	uint32_t prev;	/* more recently used; MAP_NONE if none */
+	uint32_t next;	/* less recently used, or next unused entry */
+} map_entry_t;
+
+/*
+ * open-addressing hash table (linear probing with backward-shift deletion)
+ * of a fixed number of entries, whose keys are the bytes of fields of data
+ * objects; entries are kept in LRU order and the least recently used one is
+ * evicted when the table is full
+ */
+typedef struct {
+	uint32_t       *buckets;	/* entry index plus 1; 0 if empty */
+	map_entry_t    *entries;
+	byte_t         *keys;
+	size_t          mask;		/* of bucket indexes */
+	size_t          capacity;	/* of entries */
+	size_t          count;
+	uint32_t        head;		/* most recently used entry */
+	uint32_t        tail;		/* least recently used entry */
+	uint32_t        unused;		/* first unused entry */
+	layout_t       *layout;
+	layout_entry_t *fields[ MAP_MAX_FIELDS ];
+	size_t          sizes[ MAP_MAX_FIELDS ];
+	size_t          nfields;
+	size_t          key_size;
+	size_t          slot_size;	/* 0 if values are Lua values */
+	data_t         *slots;
+	data_t         *cursor;	/* moved to the slot of each value */
+} map_t;
+
+map_t * map_new(lua_State *, int, int, size_t, size_t);
+
+int map_get(lua_State *, int, data_t *);
+
+int map_upsert(lua_State *, int, data_t *, int);
+
+int map_delete(lua_State *, int, data_t *);
+
+void map_free(lua_State *, map_t *);
+
+#endif /* _MAP_H_ */
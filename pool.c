@@ -0,0 +1,321 @@
+/*
+ * Copyright (c) 2014, Lourival Vieira Neto <lneto@NetBSD.org>.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the Author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <sched.h>
+
+#include <lauxlib.h>
+#include <lualib.h>
+
+#include "luautil.h"
+
+#include "pool.h"
+#include "data.h"
+
+static void
+queue_init(pool_queue_t *queue)
+{
+	for (size_t i = 0; i < POOL_QUEUE_SIZE; i++)
+		atomic_init(&queue->cells[ i ].sequence, i);
+
+	atomic_init(&queue->enqueue, 0);
+	atomic_init(&queue->dequeue, 0);
+}
+
+static bool
+queue_push(pool_queue_t *queue, pool_item_t *item)
+{
+	pool_cell_t *cell;
+	size_t pos = atomic_load_explicit(&queue->enqueue,
+		memory_order_relaxed);
+
+	for (;;) {
+		cell = &queue->cells[ pos & (POOL_QUEUE_SIZE - 1) ];
+		size_t seq = atomic_load_explicit(&cell->sequence,
+			memory_order_acquire);
+		intptr_t diff = (intptr_t) seq - (intptr_t) pos;
+
+		if (diff == 0) {
+			if (atomic_compare_exchange_weak_explicit(
+				&queue->enqueue, &pos, pos + 1,
+				memory_order_relaxed, memory_order_relaxed))
+				break;
+		}
+		else if (diff < 0)
+			return false;  /* full */
+		else
+			pos = atomic_load_explicit(&queue->enqueue,
+				memory_order_relaxed);
+	}
+
+	cell->item = *item;
+	atomic_store_explicit(&cell->sequence, pos + 1, memory_order_release);
+	return true;
+}
+
+static bool
+queue_pop(pool_queue_t *queue, pool_item_t *item)
+{
+	pool_cell_t *cell;
+	size_t pos = atomic_load_explicit(&queue->dequeue,
+		memory_order_relaxed);
+
+	for (;;) {
+		cell = &queue->cells[ pos & (POOL_QUEUE_SIZE - 1) ];
+		size_t seq = atomic_load_explicit(&cell->sequence,
+			memory_order_acquire);
+		intptr_t diff = (intptr_t) seq - (intptr_t) (pos + 1);
+
+		if (diff == 0) {
+			if (atomic_compare_exchange_weak_explicit(
+				&queue->dequeue, &pos, pos + 1,
+				memory_order_relaxed, memory_order_relaxed))
+				break;
+		}
+		else if (diff < 0)
+			return false;  /* empty */
+		else
+			pos = atomic_load_explicit(&queue->dequeue,
+				memory_order_relaxed);
+	}
+
+	*item = cell->item;
+	atomic_store_explicit(&cell->sequence, pos + POOL_QUEUE_SIZE,
+		memory_order_release);
+	return true;
+}
+
+static int
+new_data(lua_State *L)
+{
+	data_new(L, NULL, 0, false);
+	return 1;
+}
+
+/* replaces the data object of a worker; returns false on error */
+static bool
+worker_newdata(pool_worker_t *worker)
+{
+	lua_State *L = worker->L;
+
+	lua_pushcfunction(L, new_data);
+	if (lua_pcall(L, 0, 1, 0) != 0) {
+		lua_pop(L, 1);
+		return false;
+	}
+
+	luau_unref(L, worker->data);
+	worker->data = luau_ref(L);
+	return true;
+}
+
+static bool
+worker_open(pool_worker_t *worker, const char *script, const char *function)
+{
+	lua_State *L = luaL_newstate();
+	if (L == NULL)
+		return false;
+
+	worker->L    = L;
+	worker->data = LUA_NOREF;
+
+	luaL_openlibs(L);
+#if LUA_VERSION_NUM >= 502
+	luaL_requiref(L, "data", luaopen_data, 1);
+#else
+	lua_pushcfunction(L, luaopen_data);
+	lua_call(L, 0, 1);
+#endif
+	lua_pop(L, 1);  /* remove lib */
+
+	if (luaL_dofile(L, script) != 0)
+		return false;
+
+	lua_getglobal(L, function);
+	if (!lua_isfunction(L, -1))
+		return false;
+
+	worker->function = luau_ref(L);
+	return worker_newdata(worker);
+}
+
+static int
+worker_call(pool_worker_t *worker, pool_item_t *item)
+{
+	lua_State *L = worker->L;
+
+	luau_getref(L, worker->function);
+	luau_getref(L, worker->data);
+
+	data_t *data = (data_t *) lua_touserdata(L, -1);
+
+	/* reuse the data object, unless a segment still refers to it */
+	if (!data_rebind(data, item->ptr, item->size)) {
+		lua_pop(L, 1);
+		if (!worker_newdata(worker))
+			return -1;
+
+		luau_getref(L, worker->data);
+		data = (data_t *) lua_touserdata(L, -1);
+		data_rebind(data, item->ptr, item->size);
+	}
+
+	int verdict;
+	if (lua_pcall(L, 1, 1, 0) != 0)
+		verdict = -1;
+	else if (lua_isnumber(L, -1))
+		verdict = (int) lua_tointeger(L, -1);
+	else
+		verdict = lua_toboolean(L, -1);
+
+	lua_pop(L, 1);
+
+	/* the buffer cannot be accessed after the call, as ldata_unref() */
+	data_unref(data);
+	return verdict;
+}
+
+static void *
+worker_run(void *arg)
+{
+	pool_worker_t *worker = (pool_worker_t *) arg;
+	pool_t *pool = worker->pool;
+
+	for (;;) {
+		while (sem_wait(&pool->items) != 0 && errno == EINTR)
+			;
+
+		/*
+		 * each item is posted once, but a producer which claimed an
+		 * earlier slot may not have published it yet; the queue is
+		 * only empty for good once pool_join() posts the extra tokens
+		 */
+		pool_item_t item;
+		while (!queue_pop(&pool->queue, &item)) {
+			if (atomic_load_explicit(&pool->shutdown,
+				memory_order_acquire))
+				return NULL;
+			sched_yield();
+		}
+
+		int verdict = worker_call(worker, &item);
+		if (item.callback != NULL)
+			item.callback(item.ptr, item.size, verdict, item.arg);
+	}
+	return NULL;
+}
+
+static void
+pool_join(pool_t *pool)
+{
+	/* wake up every worker once the queue is drained */
+	atomic_store_explicit(&pool->shutdown, true, memory_order_release);
+	for (size_t i = 0; i < pool->nworkers; i++)
+		sem_post(&pool->items);
+
+	for (size_t i = 0; i < pool->nworkers; i++)
+		pthread_join(pool->workers[ i ].thread, NULL);
+}
+
+static void
+pool_close(pool_t *pool, size_t nworkers)
+{
+	for (size_t i = 0; i < nworkers; i++)
+		if (pool->workers[ i ].L != NULL)
+			lua_close(pool->workers[ i ].L);
+
+	sem_destroy(&pool->items);
+	free(pool->workers);
+	free(pool);
+}
+
+pool_t *
+pool_create(size_t nworkers, const char *script, const char *function)
+{
+	if (nworkers == 0)
+		return NULL;
+
+	pool_t *pool = (pool_t *) aligned_alloc(POOL_CACHE_LINE,
+		(sizeof(pool_t) + POOL_CACHE_LINE - 1) & ~(POOL_CACHE_LINE - 1));
+	if (pool == NULL)
+		return NULL;
+
+	pool->workers = (pool_worker_t *) calloc(nworkers,
+		sizeof(pool_worker_t));
+	if (pool->workers == NULL || sem_init(&pool->items, 0, 0) != 0) {
+		free(pool->workers);
+		free(pool);
+		return NULL;
+	}
+
+	queue_init(&pool->queue);
+	atomic_init(&pool->shutdown, false);
+	pool->nworkers = 0;
+
+	/* load every state up front, so script errors are caught here */
+	for (size_t i = 0; i < nworkers; i++) {
+		pool_worker_t *worker = &pool->workers[ i ];
+		worker->pool = pool;
+		if (!worker_open(worker, script, function)) {
+			pool_close(pool, i + 1);
+			return NULL;
+		}
+	}
+
+	for (; pool->nworkers < nworkers; pool->nworkers++) {
+		pool_worker_t *worker = &pool->workers[ pool->nworkers ];
+		if (pthread_create(&worker->thread, NULL, worker_run,
+			worker) != 0) {
+			pool_join(pool);
+			pool_close(pool, nworkers);
+			return NULL;
+		}
+	}
+	return pool;
+}
+
+bool
+pool_submit(pool_t *pool, void *ptr, size_t size, ldata_callback_t callback,
+	void *arg)
+{
+	pool_item_t item = {ptr, size, callback, arg};
+
+	if (!queue_push(&pool->queue, &item))
+		return false;
+
+	sem_post(&pool->items);
+	return true;
+}
+
+void
+pool_destroy(pool_t *pool)
+{
+	pool_join(pool);
+	pool_close(pool, pool->nworkers);
+}
@@ -0,0 +1,85 @@
+/*
+ * Copyright (c) 2014, Lourival Vieira Neto <lneto@NetBSD.org>.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the Author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#ifndef _POOL_H_
+#define _POOL_H_
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+#include <lua.h>
+
+#include "luadata.h"
+
+#define POOL_QUEUE_SIZE	(4096)	/* must be a power of two */
+#define POOL_CACHE_LINE	(64)
+
+typedef struct {
+	void             *ptr;
+	size_t            size;
+	ldata_callback_t  callback;
+	void             *arg;
+} pool_item_t;
+
+typedef struct {
+	atomic_size_t sequence;
+	pool_item_t   item;
+} pool_cell_t;
+
+/* bounded MPMC queue by Dmitry Vyukov */
+typedef struct {
+	pool_cell_t cells[ POOL_QUEUE_SIZE ];
+	_Alignas(POOL_CACHE_LINE) atomic_size_t enqueue;
+	_Alignas(POOL_CACHE_LINE) atomic_size_t dequeue;
+} pool_queue_t;
+
+typedef struct {
+	pthread_t      thread;
+	lua_State     *L;
+	int            function;
+	int            data;
+	struct pool   *pool;
+} pool_worker_t;
+
+typedef struct pool {
+	pool_queue_t   queue;
+	sem_t          items;
+	atomic_bool    shutdown;
+	size_t         nworkers;
+	pool_worker_t *workers;
+} pool_t;
+
+pool_t * pool_create(size_t, const char *, const char *);
+
+bool pool_submit(pool_t *, void *, size_t, ldata_callback_t, void *);
+
+void pool_destroy(pool_t *);
+
+#endif /* _POOL_H_ */
@@ -0,0 +1,71 @@
+/*
+ * Copyright (c) 2014, Lourival Vieira Neto <lneto@NetBSD.org>.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the Author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#ifndef _PROBES_H_
+#define _PROBES_H_
+
+/*
+ * static tracepoints (USDT) of the luadata provider; enabled by building with
+ * -DDATA_SDT, which requires <sys/sdt.h> (e.g., from systemtap-sdt-dev)
+ */
+#if defined(DATA_SDT) && !defined(_KERNEL)
+#define _SDT_HAS_SEMAPHORES	1
+#include <sys/sdt.h>
+
+/*
+ * tracers raise the semaphore of a probe while attached to it, so costly
+ * arguments can be computed only then; see DATA_PROBE_ENABLED()
+ */
+#define DATA_PROBE_SEMAPHORE(name) \
+	static unsigned short luadata_##name##_semaphore \
+	__attribute__((used, section(".probes")))
+
+DATA_PROBE_SEMAPHORE(data_new);
+DATA_PROBE_SEMAPHORE(data_new_segment);
+DATA_PROBE_SEMAPHORE(data_apply_layout);
+DATA_PROBE_SEMAPHORE(data_get_field);
+DATA_PROBE_SEMAPHORE(data_set_field);
+DATA_PROBE_SEMAPHORE(handle_get_ptr);
+DATA_PROBE_SEMAPHORE(handle_delete);
+
+#define DATA_PROBE_ENABLED(name) \
+	__builtin_expect(luadata_##name##_semaphore != 0, 0)
+
+#define DATA_PROBE2(name, a1, a2) \
+	DTRACE_PROBE2(luadata, name, a1, a2)
+#define DATA_PROBE3(name, a1, a2, a3) \
+	DTRACE_PROBE3(luadata, name, a1, a2, a3)
+#define DATA_PROBE4(name, a1, a2, a3, a4) \
+	DTRACE_PROBE4(luadata, name, a1, a2, a3, a4)
+#else
+#define DATA_PROBE_ENABLED(name)	(0)
+#define DATA_PROBE2(name, a1, a2)
+#define DATA_PROBE3(name, a1, a2, a3)
+#define DATA_PROBE4(name, a1, a2, a3, a4)
+#endif
+
+#endif /* _PROBES_H_ */
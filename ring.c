@@ -0,0 +1,275 @@
+/*
+ * Copyright (c) 2014, Lourival Vieira Neto <lneto@NetBSD.org>.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the Author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <lauxlib.h>
+
+#include "luautil.h"
+
+#include "ring.h"
+#include "data.h"
+
+#define RING_MAGIC	(0x6c647269)
+
+/* records are 8-byte aligned, so a padding header always fits at the end */
+typedef struct {
+	uint32_t length;
+	uint32_t flags;
+} record_t;
+
+#define RECORD_PADDING		(1)
+#define RECORD_ALIGN(length)	((length + 7) & ~(size_t) 7)
+#define RECORD_SIZE(length)	(sizeof(record_t) + RECORD_ALIGN(length))
+
+static void
+ring_init(ring_t *ring, size_t capacity)
+{
+	atomic_init(&ring->head, 0);
+	atomic_init(&ring->tail, 0);
+	ring->reserved   = 0;
+	ring->tail_cache = 0;
+	ring->read       = 0;
+	ring->capacity   = capacity;
+
+	/* attaching processes check the magic last */
+	atomic_thread_fence(memory_order_release);
+	ring->magic = RING_MAGIC;
+}
+
+static ring_t *
+ring_map(size_t capacity, const char *name, size_t size)
+{
+	int  flags   = MAP_SHARED;
+	int  fd      = -1;
+	bool created = true;
+
+	if (name == NULL)
+		flags |= MAP_ANONYMOUS;
+	else {
+		fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+		if (fd < 0 && errno == EEXIST) {
+			created = false;
+			fd = shm_open(name, O_RDWR, 0600);
+		}
+		if (fd < 0)
+			return NULL;
+
+		struct stat st;
+		if ((created && ftruncate(fd, (off_t) size) != 0) ||
+			(!created && (fstat(fd, &st) != 0 ||
+			(size_t) st.st_size != size))) {
+			if (created)
+				shm_unlink(name);
+			close(fd);
+			return NULL;
+		}
+	}
+
+	ring_t *ring = (ring_t *) mmap(NULL, size, PROT_READ | PROT_WRITE,
+		flags, fd, 0);
+	if (fd >= 0)
+		close(fd);
+
+	if (ring == MAP_FAILED)
+		return NULL;
+
+	if (created)
+		ring_init(ring, capacity);
+	else if (ring->magic != RING_MAGIC || ring->capacity != capacity) {
+		munmap(ring, size);
+		return NULL;
+	}
+	return ring;
+}
+
+ring_object_t *
+ring_new(lua_State *L, size_t capacity, const char *name)
+{
+	/* round capacity up to a power of two */
+	size_t pow2 = RING_CACHE_LINE;
+	while (pow2 < capacity) {
+		if (pow2 > ((size_t) -1 >> 2))
+			return NULL;
+		pow2 <<= 1;
+	}
+
+	size_t size = sizeof(ring_t) + pow2;
+	ring_t *ring = ring_map(pow2, name, size);
+	if (ring == NULL)
+		return NULL;
+
+	ring_object_t *object = (ring_object_t *) lua_newuserdata(L,
+		sizeof(ring_object_t));
+	object->ring  = ring;
+	object->size  = size;
+	object->batch = NULL;
+
+	luau_setmetatable(L, RING_USERDATA);
+	return object;
+}
+
+inline ring_t *
+ring_test(lua_State *L, int index)
+{
+	ring_object_t *object = (ring_object_t *) luau_testudata(L, index,
+		RING_USERDATA);
+	return object != NULL ? object->ring : NULL;
+}
+
+void *
+ring_reserve(ring_t *ring, size_t length)
+{
+	size_t capacity = ring->capacity;
+
+	if (length == 0 || length > UINT32_MAX ||
+		RECORD_SIZE(length) > capacity)
+		return NULL;
+
+	size_t size  = RECORD_SIZE(length);
+	size_t head  = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	size_t index = head & (capacity - 1);
+
+	/* records are contiguous; skip the end of the buffer if needed */
+	size_t padding = capacity - index < size ? capacity - index : 0;
+
+	if (head + padding + size - ring->tail_cache > capacity) {
+		ring->tail_cache = atomic_load_explicit(&ring->tail,
+			memory_order_acquire);
+		if (head + padding + size - ring->tail_cache > capacity)
+			return NULL;  /* full */
+	}
+
+	if (padding > 0) {
+		record_t *record = (record_t *) (ring->buffer + index);
+		record->length = 0;
+		record->flags  = RECORD_PADDING;
+
+		head += padding;
+		index = 0;
+	}
+
+	ring->reserved = head;
+	return ring->buffer + index + sizeof(record_t);
+}
+
+void
+ring_commit(ring_t *ring, size_t length)
+{
+	size_t index = ring->reserved & (ring->capacity - 1);
+
+	/* assertion: length is not greater than the reserved one */
+	record_t *record = (record_t *) (ring->buffer + index);
+	record->length = (uint32_t) length;
+	record->flags  = 0;
+
+	atomic_store_explicit(&ring->head, ring->reserved + RECORD_SIZE(length),
+		memory_order_release);
+}
+
+static void
+release_batch(lua_State *L, ring_object_t *object)
+{
+	if (object->batch != NULL) {
+		/* invalidate the segments of the last batch */
+		handle_unref(object->batch);
+		handle_delete(L, object->batch);
+		object->batch = NULL;
+	}
+
+	ring_t *ring = object->ring;
+	atomic_store_explicit(&ring->tail, ring->read, memory_order_release);
+}
+
+int
+ring_dequeue(lua_State *L, ring_object_t *object, size_t max)
+{
+	ring_t *ring = object->ring;
+	size_t capacity = ring->capacity;
+
+	release_batch(L, object);
+
+	size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+	size_t read = ring->read;
+	if (read == head || max == 0)
+		return 0;
+
+	/* every segment of this batch refers to the same handle */
+	data_t *batch = data_new(L, ring->buffer, capacity, false);
+	object->batch = batch->handle;
+	object->batch->refcount++;
+
+	int n = 0;
+	while (read != head && (size_t) n < max) {
+		size_t index = read & (capacity - 1);
+		record_t *record = (record_t *) (ring->buffer + index);
+
+		/* headers lie in shared memory, thus are read once and checked */
+		uint32_t flags  = record->flags;
+		size_t   length = record->length;
+		size_t   size   = flags & RECORD_PADDING ? capacity - index :
+			RECORD_SIZE(length);
+
+		if (size > head - read || sizeof(record_t) + length >
+		    capacity - index)
+			break;
+
+		if (flags & RECORD_PADDING) {
+			read += size;
+			continue;
+		}
+
+		luaL_checkstack(L, 1, "too many records");
+		if (data_new_segment(L, batch, index + sizeof(record_t),
+			length) == 0)
+			break;
+
+		read += size;
+		n++;
+	}
+
+	/* stops at a malformed record, after the ones preceding it */
+	ring->read = read;
+	if (n == 0 && read != head)
+		return luaL_error(L, "malformed ring record");
+
+	/* remove the batch data object, keeping its segments */
+	lua_remove(L, -(n + 1));
+	return n;
+}
+
+void
+ring_delete(lua_State *L, ring_object_t *object)
+{
+	release_batch(L, object);
+	munmap(object->ring, object->size);
+}
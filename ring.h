@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) 2014, Lourival Vieira Neto <lneto@NetBSD.org>.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the Author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#ifndef _RING_H_
+#define _RING_H_
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+#include <lua.h>
+
+#include "handle.h"
+
+#define RING_USERDATA	"data.ring"
+
+#define RING_CACHE_LINE	(64)
+
+/*
+ * single-producer single-consumer ring of variable-length records, laid out
+ * in a single (possibly shared) memory region; positions grow monotonically
+ * and are masked by capacity, which is a power of two
+ */
+typedef struct ring {
+	/* producer line */
+	_Alignas(RING_CACHE_LINE) atomic_size_t head;
+	size_t        reserved;	/* position of the pending record */
+	size_t        tail_cache;
+
+	/* consumer line */
+	_Alignas(RING_CACHE_LINE) atomic_size_t tail;
+	size_t        read;	/* end of the last dequeued batch */
+
+	/* read-only line */
+	_Alignas(RING_CACHE_LINE) size_t capacity;
+	uint32_t      magic;
+
+	_Alignas(RING_CACHE_LINE) char buffer[ ];
+} ring_t;
+
+typedef struct {
+	ring_t   *ring;
+	size_t    size;		/* of the mapping */
+	handle_t *batch;	/* referred by the last dequeued segments */
+} ring_object_t;
+
+ring_object_t * ring_new(lua_State *, size_t, const char *);
+
+ring_t * ring_test(lua_State *, int);
+
+void * ring_reserve(ring_t *, size_t);
+
+void ring_commit(ring_t *, size_t);
+
+int ring_dequeue(lua_State *, ring_object_t *, size_t);
+
+void ring_delete(lua_State *, ring_object_t *);
+
+#endif /* _RING_H_ */
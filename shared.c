@@ -0,0 +1,111 @@
+/*
+ * Copyright (c) 2014, Lourival Vieira Neto <lneto@NetBSD.org>.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the Author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#include "handle.h"
+#include "shared.h"
+
+/*
+ * shared raw data is freed by the allocator of the Lua state which has
+ * exported it, from whichever thread drops the last reference; thus, such
+ * allocator must be thread-safe and outlive the shared raw data (as the
+ * default one of luaL_newstate())
+ */
+shared_t *
+shared_new(lua_State *L, void *ptr, size_t size)
+{
+	void *ud;
+	lua_Alloc alloc = lua_getallocf(L, &ud);
+
+	shared_t *shared = (shared_t *) alloc(ud, NULL, 0, sizeof(shared_t));
+	if (shared == NULL)
+		return NULL;
+
+	shared->ptr   = ptr;
+	shared->size  = size;
+	shared->alloc = alloc;
+	shared->ud    = ud;
+	atomic_init(&shared->refcount, 1);
+	atomic_init(&shared->writer, false);
+	return shared;
+}
+
+void
+shared_retain(shared_t *shared)
+{
+	atomic_fetch_add_explicit(&shared->refcount, 1, memory_order_relaxed);
+}
+
+void
+shared_release(shared_t *shared)
+{
+	/* makes prior writes visible to the thread freeing the raw data */
+	if (atomic_fetch_sub_explicit(&shared->refcount, 1,
+		memory_order_acq_rel) != 1)
+		return;
+
+	shared->alloc(shared->ud, shared->ptr, ALLOC_SIZE(shared->size), 0);
+	shared->alloc(shared->ud, shared, sizeof(shared_t), 0);
+}
+
+bool
+shared_lock_writer(shared_t *shared)
+{
+	bool unlocked = false;
+	return atomic_compare_exchange_strong(&shared->writer, &unlocked,
+		true);
+}
+
+void
+shared_unlock_writer(shared_t *shared)
+{
+	atomic_store(&shared->writer, false);
+}
+
+shared_token_t *
+shared_token_new(shared_t *shared, size_t offset, size_t length)
+{
+	shared_token_t *token = (shared_token_t *) shared->alloc(shared->ud,
+		NULL, 0, sizeof(shared_token_t));
+	if (token == NULL)
+		return NULL;
+
+	shared_retain(shared);
+
+	token->shared = shared;
+	token->offset = offset;
+	token->length = length;
+	return token;
+}
+
+void
+shared_token_delete(shared_token_t *token)
+{
+	shared_t *shared = token->shared;
+
+	shared->alloc(shared->ud, token, sizeof(shared_token_t), 0);
+	shared_release(shared);
+}
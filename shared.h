@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) 2014, Lourival Vieira Neto <lneto@NetBSD.org>.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the Author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#ifndef _SHARED_H_
+#define _SHARED_H_
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+#include <lua.h>
+
+/* raw data shared among Lua states; see ldata_export() */
+typedef struct {
+	void         *ptr;
+	size_t        size;
+	atomic_size_t refcount;
+	atomic_bool   writer;
+	lua_Alloc     alloc;
+	void         *ud;
+} shared_t;
+
+/* a reference for a range of shared raw data, passed among Lua states */
+typedef struct {
+	shared_t *shared;
+	size_t    offset;
+	size_t    length;
+} shared_token_t;
+
+shared_t * shared_new(lua_State *, void *, size_t);
+
+void shared_retain(shared_t *);
+
+void shared_release(shared_t *);
+
+bool shared_lock_writer(shared_t *);
+
+void shared_unlock_writer(shared_t *);
+
+shared_token_t * shared_token_new(shared_t *, size_t, size_t);
+
+void shared_token_delete(shared_token_t *);
+
+#endif /* _SHARED_H_ */
@@ -0,0 +1,142 @@
+/*
+ * Copyright (c) 2014, Lourival Vieira Neto <lneto@NetBSD.org>.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the Author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#ifndef _KERNEL
+#include <string.h>
+#else
+#if defined(__NetBSD__)
+#include <lib/libkern/libkern.h>
+#elif defined(__linux__)
+#include <linux/kernel.h>
+#endif
+#endif
+
+#include <lua.h>
+#include <lauxlib.h>
+
+#include "luautil.h"
+
+#include "stats.h"
+
+#ifdef DATA_STATS
+#define STATS_KEY	"data.stats.state"
+
+static int
+stats_gc(lua_State *L)
+{
+	stats_t *stats = *(stats_t **) lua_touserdata(L, 1);
+
+	/* live handles might still refer to stats; see stats_release() */
+	stats->closed = true;
+	stats_release(L, stats);
+	return 0;
+}
+
+void
+stats_open(lua_State *L)
+{
+	lua_getfield(L, LUA_REGISTRYINDEX, STATS_KEY);
+	bool opened = !lua_isnil(L, -1);
+	lua_pop(L, 1);
+	if (opened)
+		return;
+
+	stats_t *stats = (stats_t *) luau_malloc(L, sizeof(stats_t));
+	if (stats == NULL)
+		luaL_error(L, "not enough memory");
+
+	memset(stats, 0, sizeof(stats_t));
+
+	stats_t **ud = (stats_t **) lua_newuserdata(L, sizeof(stats_t *));
+	*ud = stats;
+
+	luaL_newmetatable(L, STATS_USERDATA);
+	lua_pushcfunction(L, stats_gc);
+	lua_setfield(L, -2, "__gc");
+	lua_setmetatable(L, -2);
+
+	lua_setfield(L, LUA_REGISTRYINDEX, STATS_KEY);
+}
+
+stats_t *
+stats_get(lua_State *L)
+{
+	lua_getfield(L, LUA_REGISTRYINDEX, STATS_KEY);
+	stats_t **ud = (stats_t **) lua_touserdata(L, -1);
+	lua_pop(L, 1);
+
+	return ud != NULL ? *ud : NULL;
+}
+
+void
+stats_release(lua_State *L, stats_t *stats)
+{
+	/* stats outlive the Lua state until the last handle is freed */
+	if (stats->closed && stats->counters.handles == 0)
+		luau_free(L, stats, sizeof(stats_t));
+}
+
+#define SET_COUNTER(L, counters, name) \
+	(luau_pushsize(L, counters->name), lua_setfield(L, -2, #name))
+
+int
+stats_push(lua_State *L)
+{
+	stats_t *stats = stats_get(L);
+	if (stats == NULL)
+		return 0;
+
+	ldata_stats_t *counters = &stats->counters;
+
+	lua_newtable(L);
+	SET_COUNTER(L, counters, data);
+	SET_COUNTER(L, counters, segments);
+	SET_COUNTER(L, counters, handles);
+	SET_COUNTER(L, counters, bytes);
+	SET_COUNTER(L, counters, allocs);
+	SET_COUNTER(L, counters, frees);
+	SET_COUNTER(L, counters, number_reads);
+	SET_COUNTER(L, counters, number_writes);
+	SET_COUNTER(L, counters, string_reads);
+	SET_COUNTER(L, counters, string_writes);
+	SET_COUNTER(L, counters, misses);
+	SET_COUNTER(L, counters, pulldowns);
+	SET_COUNTER(L, counters, copies);
+	return 1;
+}
+#else
+void
+stats_open(lua_State *L)
+{
+}
+
+int
+stats_push(lua_State *L)
+{
+	return 0;
+}
+#endif
@@ -0,0 +1,67 @@
+/*
+ * Copyright (c) 2014, Lourival Vieira Neto <lneto@NetBSD.org>.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the Author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#ifndef _STATS_H_
+#define _STATS_H_
+
+#ifndef _KERNEL
+#include <stddef.h>
+#include <stdbool.h>
+#endif
+
+#include <lua.h>
+
+#include "luadata.h"
+
+#define STATS_USERDATA	"data.stats"
+
+#ifdef DATA_STATS
+typedef struct {
+	ldata_stats_t counters;
+	bool          closed;
+} stats_t;
+
+#define STATS_INC(stats, counter)	((stats)->counters.counter++)
+#define STATS_DEC(stats, counter)	((stats)->counters.counter--)
+#define STATS_ADD(stats, counter, n)	((stats)->counters.counter += (n))
+#define STATS_SUB(stats, counter, n)	((stats)->counters.counter -= (n))
+
+stats_t * stats_get(lua_State *);
+
+void stats_release(lua_State *, stats_t *);
+#else
+#define STATS_INC(stats, counter)
+#define STATS_DEC(stats, counter)
+#define STATS_ADD(stats, counter, n)
+#define STATS_SUB(stats, counter, n)
+#endif
+
+void stats_open(lua_State *);
+
+int stats_push(lua_State *);
+
+#endif /* _STATS_H_ */
@@ -39,6 +39,8 @@
 #endif
 
 #ifdef __GNUC__
+#define bswap16		__builtin_bswap16
+#define bswap32		__builtin_bswap32
 #define bswap64		__builtin_bswap64
 #ifndef BYTE_ORDER
 #define BYTE_ORDER	__BYTE_ORDER__
@@ -2,6 +2,10 @@
 #include <stdio.h>
 #include <stddef.h>
 #include <assert.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
 
 #include <lua.h>
 #include <lauxlib.h>
@@ -10,6 +14,49 @@
 
 typedef unsigned char byte_t;
 
+static atomic_int passed_count;
+static atomic_int failed_count;
+
+static void
+count_verdict(void *ptr, size_t size, int verdict, void *arg)
+{
+	if (verdict == 1)
+		atomic_fetch_add(&passed_count, 1);
+	else if (verdict == 0)
+		atomic_fetch_add(&failed_count, 1);
+}
+
+static byte_t good[ ] = {0xAB, 0xCD, 0xEF};
+static byte_t bad[ ]  = {0x00, 0x00, 0x00};
+
+/* submits 1000 buffers, of which 100 are bad */
+static void *
+submit(void *pool)
+{
+	for (int i = 0; i < 1000; i++)
+		while (!ldata_pool_submit(pool, i % 10 ? good : bad, 3,
+			count_verdict, NULL))
+			;
+	return NULL;
+}
+
+#define RING_RECORDS	(10000)
+
+/* produces records of 1 to 8 bytes, each one filled with its number */
+static void *
+produce(void *ring)
+{
+	for (int i = 0; i < RING_RECORDS; i++) {
+		size_t size = 1 + i % 8;
+		void *record;
+		while ((record = ldata_ring_reserve(ring, size)) == NULL)
+			;
+		memset(record, i & 0xFF, size);
+		ldata_ring_commit(ring, size);
+	}
+	return NULL;
+}
+
 int
 main(void)
 {
@@ -47,6 +94,11 @@ main(void)
 	int passed = lua_toboolean(L, -1);
 	assert(passed);
 
+	/* check runtime statistics, if enabled */
+	const ldata_stats_t *stats = ldata_stats(L);
+	if (stats != NULL)
+		assert(stats->handles > 0 && stats->number_reads == 3);
+
 	/* unregister the Lua data object */
 	ldata_unref(L, rd);
 
@@ -87,6 +139,182 @@ main(void)
 	assert(data_ptr == NULL);
 	assert(data_size == 0);
 
+	/* decode an Ethernet frame carrying UDP over IPv4 and its padding */
+	byte_t frame[ 46 ] = {
+		0x02, 0x00, 0x00, 0x00, 0x00, 0x02, 0x02, 0x00, 0x00, 0x00,
+		0x00, 0x01, 0x08, 0x00,
+		0x45, 0x00, 0x00, 0x1c, 0x00, 0x00, 0x00, 0x00, 0x40, 0x11,
+		0x00, 0x00, 0x0a, 0x00, 0x00, 0x01, 0x0a, 0x00, 0x00, 0x02,
+		0x04, 0xd2, 0x00, 0x35, 0x00, 0x08, 0x00, 0x00
+	};
+	int rf = ldata_newref(L, frame, sizeof(frame));
+	assert(ldata_decode(L, -1) == 1);
+
+	/* get the decoded function, under the decoded layers */
+	lua_getglobal(L, "decoded");
+	lua_insert(L, -2);
+
+	/* call decoded() to read the UDP destination port */
+	assert(lua_pcall(L, 1, 1, 0) == 0);
+	assert(lua_tointeger(L, -1) == 53);
+	lua_pop(L, 2);
+
+	ldata_unref(L, rf);
+
+	/* create a new arena and pass it to Lua */
+	int ra = ldata_newarena(L, 256);
+	lua_setglobal(L, "arena");
+
+	/* get the arena_new function */
+	lua_getglobal(L, "arena_new");
+
+	/* call arena_new() to allocate a data object in the arena */
+	assert(lua_pcall(L, 0, 1, 0) == 0);
+	assert(lua_toboolean(L, -1));
+	lua_pop(L, 1);
+
+	/* release everything allocated in the arena */
+	ldata_resetarena(L, ra);
+
+	lua_getglobal(L, "access_arena");
+	assert(lua_pcall(L, 0, 1, 0) == 0);
+
+	/* should return nil */
+	assert(lua_isnil(L, -1));
+	lua_pop(L, 1);
+
+	ldata_unrefarena(L, ra);
+
+	/* create another Lua state */
+	lua_State *L2 = luaL_newstate();
+#if LUA_VERSION_NUM >= 502
+	luaL_requiref(L2, "data", luaopen_data, 1);
+#else
+	luaopen_data(L2);
+#endif
+	lua_pop(L2, 1);  /* remove lib */
+
+	/* export a data object created by the Lua script */
+	assert(luaL_dostring(L, "sd = data.new{0x01, 0x02, 0x03}") == 0);
+	lua_getglobal(L, "sd");
+	void *token = ldata_export(L, -1);
+	assert(token != NULL);
+	lua_pop(L, 1);
+
+	/* import it as writer; there can be only one */
+	assert(ldata_import(L2, token, 1) == 1);
+	assert(ldata_import(L2, token, 1) == 0);
+
+	/* import it as reader */
+	assert(ldata_import(L2, token, 0) == 1);
+	ldata_release(token);
+
+	/* both states share the same raw data */
+	data_ptr = (byte_t *) ldata_topointer(L2, -2, &data_size);
+	assert(data_ptr != NULL && data_size == 3);
+	data_ptr[0] = 0xAA;
+
+	data_ptr = (byte_t *) ldata_topointer(L2, -1, &data_size);
+	assert(data_ptr != NULL && data_ptr[0] == 0xAA);
+
+	/* but only the writer can set fields */
+	assert(luaL_dostring(L, "sd:layout{byte = {0, 8}} sd.byte = 0\n"
+		"return sd.byte") == 0);
+	assert(lua_tointeger(L, -1) == 0xAA);
+	lua_pop(L, 1);
+
+	/* the raw data outlives the exporting state */
+	assert(luaL_dostring(L, "sd = nil") == 0);
+	lua_gc(L, LUA_GCCOLLECT, 0);
+	assert(data_ptr[1] == 0x02);
+
+	/* drop the writer, so it can be imported again */
+	lua_pop(L2, 2);
+	lua_gc(L2, LUA_GCCOLLECT, 0);
+
+	lua_close(L2);
+
+	/* run the filter function on a pool of 4 threads */
+	ldata_pool_t *pool = ldata_pool_create(4, "ctest.lua", "filter");
+	assert(pool != NULL);
+
+	submit(pool);
+
+	/* wait for every buffer to be filtered */
+	ldata_pool_destroy(pool);
+	assert(passed_count == 900 && failed_count == 100);
+
+	/* no buffer is lost when producers race for the queue */
+	pool = ldata_pool_create(4, "ctest.lua", "filter");
+	assert(pool != NULL);
+
+	pthread_t producers[ 4 ];
+	for (int i = 0; i < 4; i++)
+		assert(pthread_create(&producers[ i ], NULL, submit,
+			pool) == 0);
+	for (int i = 0; i < 4; i++)
+		pthread_join(producers[ i ], NULL);
+
+	ldata_pool_destroy(pool);
+	assert(passed_count == 900 * 5 && failed_count == 100 * 5);
+
+	/* consume records produced by another thread from Lua */
+	assert(luaL_dostring(L, "ring = data.ring(256)") == 0);
+	lua_getglobal(L, "ring");
+	ldata_ring_t *ring = ldata_toring(L, -1);
+	assert(ring != NULL);
+	lua_pop(L, 1);
+
+	pthread_t producer;
+	assert(pthread_create(&producer, NULL, produce, ring) == 0);
+
+	int consumed = 0;
+	while (consumed < RING_RECORDS) {
+		lua_getglobal(L, "consume");
+		assert(lua_pcall(L, 0, 1, 0) == 0);
+		assert(!lua_isnil(L, -1));
+		consumed += (int) lua_tointeger(L, -1);
+		lua_pop(L, 1);
+	}
+	assert(pthread_join(producer, NULL) == 0);
+
+	/* a record overstating its length stops the batch before it */
+	int top = lua_gettop(L);
+	assert(luaL_dostring(L, "ring:dequeue()") == 0);
+	memset(ldata_ring_reserve(ring, 3), 0, 3);
+	ldata_ring_commit(ring, 3);
+	assert(ldata_ring_reserve(ring, 8) != NULL);
+	ldata_ring_commit(ring, 1000);
+	assert(luaL_dostring(L, "return ring:dequeue(2)") == 0);
+	assert(lua_gettop(L) == top + 1);
+	assert(luaL_dostring(L, "return ring:dequeue(2)") != 0);
+	lua_settop(L, top);
+
+	/* transfer data objects through a pipe and a file, in place */
+	int fds[ 2 ];
+	assert(pipe(fds) == 0);
+
+	char path[ ] = "/tmp/luadata.XXXXXX";
+	int fd = mkstemp(path);
+	assert(fd >= 0);
+	unlink(path);
+
+	lua_getglobal(L, "transfer");
+	lua_pushinteger(L, fds[0]);
+	lua_pushinteger(L, fds[1]);
+	lua_pushinteger(L, fd);
+	assert(lua_pcall(L, 3, 1, 0) == 0);
+	assert(lua_toboolean(L, -1));
+	lua_pop(L, 1);
+
+	close(fds[0]);
+	close(fds[1]);
+	close(fd);
+
+	/* invalid pools */
+	assert(ldata_pool_create(0, "ctest.lua", "filter") == NULL);
+	assert(ldata_pool_create(1, "ctest.lua", "nonexistent") == NULL);
+
 	printf("test passed ;-)\n");
 	return 0;
 }
@@ -111,6 +111,380 @@ d.uint64 = -1
 assert(d.toobig == nil)
 assert(d.uint64 == -1)
 
+-- bits beyond the field width do not overwrite its neighbors
+d = data.new(2)
+d:layout{uint4 = {4, 4}, uint12 = {4, 12, 'number', 'little'}, uint16 = {0, 16}}
+d.uint4 = 0xff
+assert(d.uint16 == 0x0f00)
+d.uint16 = 0
+d.uint12 = -1
+assert(d.uint16 == 0x0fff)
+
+-- layouts are compiled once for equal specs, without changing them
+spec = {byte = {0, 8}, word = {8, 32, 'number', 'little'}}
+l = data.layout(spec)
+assert(getmetatable(spec) == nil and type(spec.byte) == 'table')
+assert(data.layout(spec) == l)
+assert(data.layout(l) == l)
+assert(data.layout{word = {offset = 8, length = 32, endian = 'little'},
+	byte = {0, 8, 'number'}} == l)
+assert(data.layout{byte = {0, 8}, word = {8, 32}} ~= l)
+assert(data.layout{byte = {0, 4, length = 8}} == data.layout{byte = {0, 8}})
+assert(data.layout{byte = {0, 8}, [1] = {0, 8}} ~= data.layout{byte = {0, 8}})
+
+-- compiled layouts are immutable
+assert(not pcall(function () l.new = {0, 8} end))
+assert(not pcall(function () l.byte = {0, 16} end))
+assert(not pcall(function () l.__layout = l end))
+assert(not pcall(setmetatable, l, nil) and getmetatable(l) == false)
+assert(not pcall(function () data.layouts.tcp.sport = 1 end))
+assert(l.byte ~= nil and l.__layout == nil and next(l) == nil)
+d = data.new{0x2A}
+d:layout(setmetatable({}, {__index = {byte = l.byte}}))
+assert(d.byte == nil)
+
+-- data objects keep their layouts alive, with no registry references
+local registry = 0
+for _ in pairs(debug.getregistry()) do registry = registry + 1 end
+d = data.new{0x2A}
+for i = 1, 8 do d:layout{['f' .. i] = {0, 8}} end
+collectgarbage()
+assert(d.f8 == 0x2A and d.f1 == nil)
+for _ in pairs(debug.getregistry()) do registry = registry - 1 end
+assert(registry == 0)
+
+-- accessors are bound to a field of a layout, whichever one data objects have
+l = data.layout{ttl = {64, 8}, id = {4, 2, 'string'}}
+local ttl, id = l:accessor('ttl'), l:accessor('id')
+d = data.new{0x45, 0x00, 0x00, 0x54, 0x12, 0x34, 0x40, 0x00, 0x40}
+assert(ttl(d) == 64 and id(d) == '\x12\x34' and d.ttl == nil)
+ttl(d, 63)
+d:layout(l)
+assert(d.ttl == 63 and ttl(d:segment(0, 8)) == nil and ttl(d:segment(1)) == nil)
+assert(l:accessor('none') == nil and ttl('') == nil)
+
+-- fields shadow layout methods
+assert(type(data.layout{accessor = {0, 8}}.accessor) == 'userdata')
+
+-- methods of data objects shadow fields, which are still reachable
+d = data.new{0x2A}
+l = data.layout{copy = {0, 8}}
+d:layout(l)
+d.copy = 0
+assert(type(d.copy) == 'function' and d:unpack('copy') == 0x2A)
+l:accessor('copy')(d, 0x2B)
+assert(d:unpack('copy') == 0x2B)
+
+-- numeric keys work as field names
+d = data.new{0x2A}
+d:layout{[1] = {0, 8}}
+assert(d[1] == 0x2A)
+
+-- unpack fields sharing a word along with the others
+d = data.new{0x45, 0x10, 0x00, 0x54, 0x12, 0x34, 0x40, 0x00, 0x40, 0x06,
+	0xbe, 0xef, 0x0a, 0x00, 0x00, 0x01, 0x0a, 0x00, 0x00, 0x02}
+d:layout{version = {0, 4}, ihl = {4, 4}, dscp = {8, 6}, ecn = {14, 2},
+	tot_len = {16, 16}, ttl = {64, 8}, protocol = {72, 8},
+	cross = {60, 8}, le = {80, 16, 'number', 'little'},
+	dst = {128, 32}, tail = {144, 16}, str = {4, 2, 'string'}}
+assert(select('#', d:unpack('version', 'none', 'ihl')) == 3)
+v, ihl, dscp, ecn, len, none = d:unpack('version', 'ihl', 'dscp', 'ecn',
+	'tot_len', 'none')
+assert(v == 4 and ihl == 5 and dscp == 4 and ecn == 0 and len == 84)
+assert(none == nil)
+ttl, proto, cross, le, dst, tail, str = d:unpack('ttl', 'protocol',
+	'cross', 'le', 'dst', 'tail', 'str')
+assert(ttl == 64 and proto == 6 and cross == 0x04 and le == 0xefbe)
+assert(dst == 0x0a000002 and tail == 0x0002 and str == '\x12\x34')
+assert(d.dscp == 4 and d.cross == 0x04 and d.dst == 0x0a000002)
+assert(d:unpack() == nil)
+
+-- short data objects check each field against their bounds
+d = data.new{0xff, 0x0f, 0x41}
+l = data.layout{a = {0, 8}, b = {8, 8}, c = {6, 4}, s = {2, 1, 'string'}}
+d:layout(l)
+assert(d.a == 0xff and d.b == 0x0f and d.c == 0xc and d.s == 'A')
+d1 = d:segment(0, 1)
+d1:layout(l)
+assert(d1.a == 0xff and d1.b == nil and d1.c == nil and d1.s == nil)
+d1.b = 0
+assert(d.b == 0x0f)
+
+-- unpack agrees with indexing for every field width and offset
+d = data.new{0xde, 0xad, 0xbe, 0xef, 0x01, 0x23, 0x45, 0x67, 0x89, 0xab}
+for offset = 0, 15 do
+	for length = 1, 64 do
+		d:layout{f = {offset, length}, g = {0, 8}}
+		local f, g = d:unpack('f', 'g')
+		assert(f == d.f and g == 0xde)
+	end
+end
+
+-- raw pointers are exposed along with the data length
+p, n = d:segment(2):pointer()
+assert(p ~= nil and n == 8)
+
+-- accessors read fields through the FFI, under LuaJIT
+if jit then
+	for offset = 0, 15 do
+		for length = 1, 64 do
+			for _, endian in ipairs{'big', 'little'} do
+				local l = data.layout{f = {offset, length,
+					'number', endian}}
+				local f = data.accessors(l).f
+				assert(f(d) == d:layout(l).f)
+				d1 = d:segment(0, 2)
+				assert(f(d1) == d1:layout(l).f)
+			end
+		end
+	end
+	a = data.accessors{s = {1, 3, 'string'}, huge = {0, 65}}
+	assert(a.s(d) == '\xad\xbe\xef' and a.huge(d) == nil)
+	assert(a.s(d:segment(0, 3)) == nil)
+	assert(a.s(io.stdout) == nil and a.s(data.lpm()) == nil and a.s{} == nil)
+	assert(data.accessors{s = {1, 3, 'string'}, huge = {0, 65}} == a)
+	assert(tostring(d:pointer()):find'cdata')
+else
+	assert(data.accessors{byte = {0, 8}} == nil)
+end
+
+-- decode the headers of an Ethernet frame, with a VLAN tag, IPv4 options,
+-- TCP, a payload and padding
+local function frame(...)
+	local bytes = {}
+	for _, t in ipairs{...} do
+		for _, byte in ipairs(t) do bytes[ #bytes + 1 ] = byte end
+	end
+	return bytes
+end
+
+eth = {0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xaa, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb}
+d = data.new(frame(eth, {0x81, 0x00, 0x20, 0x05, 0x08, 0x00},
+	{0x46, 0x00, 0x00, 0x2e, 0x12, 0x34, 0x40, 0x00, 0x40, 0x06, 0x00, 0x00,
+	 0xc0, 0xa8, 0x00, 0x01, 0xc0, 0xa8, 0x00, 0x02, 0x01, 0x01, 0x01, 0x00},
+	{0x1f, 0x90, 0x00, 0x50, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00,
+	 0x50, 0x12, 0xff, 0xff, 0x00, 0x00, 0x00, 0x00},
+	{0x68, 0x69, 0x00, 0x00}))
+t = d:decode()
+assert(t.ethernet.type == 0x8100 and t.ethernet.src == ('\xbb'):rep(6))
+assert(#t.vlan == 1 and t.vlan[1].vid == 5 and t.vlan[1].pcp == 1)
+assert(t.ipv4.ihl == 6 and t.ipv4.dst == 0xc0a80002 and #t.options == 4)
+assert(t.protocol == 6 and t.tcp.dport == 80 and t.tcp.flags == 0x12)
+assert(t.payload:tostring() == 'hi' and t.udp == nil and t.ipv6 == nil)
+
+-- decode IPv6 with extension headers into the same table
+d = data.new(frame(eth, {0x86, 0xdd},
+	{0x60, 0x00, 0x00, 0x00, 0x00, 0x19, 0x00, 0x40,
+	 0x20, 0x01, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x01,
+	 0x20, 0x01, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x02},
+	{0x2c, 0x00, 0x01, 0x04, 0x00, 0x00, 0x00, 0x00},
+	{0x11, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x2a},
+	{0x00, 0x35, 0x04, 0xd2, 0x00, 0x09, 0x00, 0x00, 0x78}))
+assert(d:decode(t) == t and t.tcp == nil and t.vlan == nil)
+assert(t.ipv6.hops == 64 and t.ipv6.dst:byte(16) == 0x02)
+assert(#t.extensions == 2 and t.extensions[2].next == 17)
+assert(t.protocol == 17 and t.udp.dport == 1234 and t.payload:tostring() == 'x')
+
+-- non-first fragments have no transport header
+t.extensions[2]:layout{offset = {16, 13}}.offset = 1
+t = d:decode()
+assert(t.protocol == 17 and t.udp == nil and #t.payload == 9)
+
+-- truncated and unknown headers are left in the payload
+t = d:segment(0, 20):decode()
+assert(t.ethernet and t.ipv6 == nil and t.protocol == nil and #t.payload == 6)
+d:segment(12, 2):fill(0x08):segment(1):fill(0x06)
+t = d:decode()
+assert(t.ethernet.type == 0x0806 and #t.payload == #d - 14)
+assert(data.layout(data.layouts.tcp) == data.layouts.tcp)
+local ethernet = data.layouts.ethernet
+data.layouts.ethernet = data.layout{type = {0, 8}}
+assert(d:decode().ethernet.type == 0x0806)
+data.layouts.ethernet = ethernet
+
+-- varint fields are decoded as LEB128; zigzag ones are signed
+d = data.new{0xac, 0x02, 0x03, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+	0xff, 0x01}
+d:layout{u = {0, 2, 'varint'}, z = {2, 1, 'zigzag'}, max = {3, 10, 'varint'},
+	short = {0, 1, 'varint'}, over = {3, 10, 'zigzag'}, tail = {12, 4, 'v'}}
+assert(d.u == 300 and d.z == -2 and d.max == -1 and d.over == -2^63)
+assert(d.short == nil and d.tail == 1)
+assert(select('#', d:unpack('u', 'z', 'short')) == 3)
+assert(select(2, d:unpack('u', 'z')) == -2)
+
+-- varint writes are padded to the field length
+d.u, d.z = 1, 63
+assert(d:segment(0, 3):tostring() == '\x81\x00\x7e' and d.u == 1 and d.z == 63)
+d.z = 64
+assert(d.z == 63)
+
+-- iterate over TLV elements, reusing the value segment
+d = data.new{1, 2, 0xaa, 0xbb, 2, 0, 3, 1, 0xcc, 4}
+local types, values = {}, {}
+for type, value in d:tlv(1, 1) do
+	types[#types + 1] = type
+	values[#values + 1] = #value > 0 and value:tostring() or ''
+end
+assert(table.concat(types, ',') == '1,2,3' and values[1] == '\xaa\xbb')
+assert(values[2] == '' and values[3] == '\xcc')
+
+-- widths are in bytes (0 for varints), with the given endianness
+d = data.new{0x01, 0x00, 0x02, 0x00, 0xaa, 0xbb, 0x96, 0x01, 0x01, 0xcc}
+local next, value = d:tlv(2, 2, 'little')
+local type, v = next()
+assert(type == 1 and v:tostring() == '\xaa\xbb' and v:layout{x = {0, 8}}.x == 0xaa)
+assert(next() == nil)
+next = d:segment(6):tlv(0, 0)
+assert(next() == 150 and value == nil)
+assert(d:tlv(9, 1) == nil)
+
+-- elements running out of bounds end the iteration
+d = data.new{1, 4, 0xaa, 0xbb}
+assert(d:tlv(1, 1)() == nil)
+
+-- iterate over length-prefixed frames, reporting the incomplete tail
+d = data.new{0, 2, 0xaa, 0xbb, 0, 0, 0, 3, 0xcc}
+local sizes = {}
+local frames = d:frames{len_width = 2}
+for frame in frames do sizes[#sizes + 1] = #frame end
+assert(table.concat(sizes, ',') == '4,2' and select(2, frames()) == 3)
+
+-- the length may lie within a header, as a varint, or little-endian
+d = data.new{0x17, 0x03, 0x03, 0x00, 0x01, 0xaa, 0x17, 0x03, 0x03}
+frames = d:frames{len_offset = 3, len_width = 2, header_len = 5}
+local frame = frames()
+assert(#frame == 6 and frame:layout{type = {0, 8}}.type == 0x17)
+assert(frames() == nil and select(2, frames()) == 3)
+frames = data.new{0x96, 0x01}:frames{len_width = 0}
+assert(frames() == nil and select(2, frames()) == 2)
+d = data.new{2, 0, 0xaa, 0xbb, 1, 0}
+frames = d:frames{len_width = 2, endian = 'little'}
+assert(#frames() == 4 and select(2, frames()) == 2)
+
+-- frames longer than max_len end the iteration with no tail
+frames = data.new{0, 1, 0xaa, 0, 9}:frames{max_len = 8}
+assert(#frames() == 3 and select('#', frames()) == 1)
+assert(d:frames{len_width = 9} == nil and d:frames() == nil)
+
+-- longest-prefix match over the bytes of address fields
+local routes = data.lpm()
+assert(routes:insert('\10', 8, 'ten') == routes)
+routes:insert('\10\1', 16, 'ten.one'):insert('\10\1\2\128', 25, 'half')
+routes:insert('', 0, 'default'):insert('\192\168', 12, 'private')
+assert(routes:lookup('\10\1\2\200') == 'half')
+assert(routes:lookup('\10\1\2\127') == 'ten.one')
+assert(routes:lookup('\10\2\0\0') == 'ten')
+assert(routes:lookup('\192\175\0\0') == 'private')
+assert(routes:lookup('\192\176\0\0') == 'default')
+routes:insert('\10', 8, 'TEN')
+assert(routes:lookup('\10\2\0\0') == 'TEN')
+assert(routes:insert('\10', 9, 'long') == nil and routes:insert('\10', 8) == nil)
+
+-- prefixes inserted again keep their index, even if longer ones cover them
+local nets = data.lpm():insert('\10', 7, 'a'):insert('\10', 8, 'b')
+nets:insert('\12', 8, 'c'):insert('\13', 8, 'd')
+local before = collectgarbage('count')
+for i = 1, 1000 do
+	nets:insert('\10', 7, i):insert('\12', 7, i)
+end
+assert(collectgarbage('count') - before < 4)
+assert(nets:lookup('\11') == 1000 and nets:lookup('\10') == 'b')
+assert(nets:lookup('\12') == 'c' and nets:lookup('\13') == 'd')
+
+-- lookups read number and string fields in place, even wider than integers
+d = data.new{10, 1, 2, 200, 0x20, 0x01, 0x0d, 0xb8, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 1}
+d:layout{v4 = {0, 32}, v6 = {32, 128}, v6s = {4, 16, 'string'},
+	odd = {4, 28}, le = {0, 32, 'number', 'little'}}
+assert(d.v6 == nil and routes:lookup(d, 'v4') == 'half')
+local v6 = data.lpm():insert('\x20\x01\x0d\xb8', 32, 'doc')
+v6:insert('\x20\x01\x0d\xb8' .. string.rep('\0', 11) .. '\1', 128, 'host')
+assert(v6:lookup(d, 'v6') == 'host' and v6:lookup(d, 'v6s') == 'host')
+assert(routes:insert('\xa0\x10', 16, 'odd'):lookup(d, 'odd') == 'odd' and routes:lookup(d, 'le') == nil)
+assert(routes:lookup(d:segment(0, 3), 'v4') == nil and routes:lookup(d, 'x') == nil)
+
+-- lookups agree with a linear scan over random prefixes
+local function bits(s, n)
+	local t = {}
+	for i = 1, n do
+		local byte = s:byte(math.floor((i - 1) / 8) + 1)
+		t[i] = math.floor(byte / 2 ^ (7 - (i - 1) % 8)) % 2
+	end
+	return table.concat(t)
+end
+
+local function random_address()
+	return string.char(math.random(0, 3), math.random(0, 255),
+		math.random(0, 255), math.random(0, 255))
+end
+
+local prefixes, lpm = {}, data.lpm()
+for i = 1, 300 do
+	local prefix, length = random_address(), math.random(1, 32)
+	prefixes[bits(prefix, length)] = i
+	lpm:insert(prefix, length, i)
+end
+for i = 1, 1000 do
+	local address, expected = random_address(), nil
+	for length = 32, 1, -1 do
+		expected = prefixes[bits(address, length)]
+		if expected then break end
+	end
+	assert(lpm:lookup(address) == expected)
+end
+
+-- hash maps keyed by the bytes of fields, with no strings created
+local flow = data.layout{src = {0, 32}, dst = {32, 32}, port = {8, 2, 'string'}}
+local map = data.map{layout = flow, fields = {'src', 'port'}, capacity = 2}
+local d1 = data.new{10, 0, 0, 1, 10, 0, 0, 2, 0, 80}
+local d2 = data.new{10, 0, 0, 1, 10, 0, 0, 3, 0, 80}
+local d3 = data.new{10, 0, 0, 1, 10, 0, 0, 2, 0, 81}
+assert(map:get(d1) == nil and #map == 0)
+assert(select(2, map:upsert(d1, 'http')) == true and map:get(d2) == 'http')
+assert(map:upsert(d2) == 'http' and select(2, map:upsert(d2)) == false)
+assert(map:upsert(d3) == true and #map == 2)
+
+-- the least recently used key is evicted when full
+assert(map:get(d1) == 'http')
+map:upsert(data.new{10, 0, 0, 9, 0, 0, 0, 0, 0, 80}, 'new')
+assert(map:get(d3) == nil and map:get(d1) == 'http' and #map == 2)
+assert(map:delete(d1) == true and map:delete(d1) == false and #map == 1)
+assert(map:get(data.new{10}) == nil and map:get('') == nil)
+assert(data.map{layout = flow, fields = {'none'}, capacity = 2} == nil)
+assert(data.map{layout = flow, fields = {'src'}} == nil)
+
+-- slot maps move a single segment to the slot of each key
+local counters = data.map{layout = {src = {0, 32}}, fields = {'src'},
+	capacity = 8, slot = 4}
+local slot = counters:upsert(d1):layout{packets = {0, 32}}
+slot.packets = slot.packets + 1
+assert(counters:upsert(d2) == slot and slot.packets == 1 and #slot == 4)
+slot = counters:upsert(data.new{10, 0, 0, 2})
+assert(slot.packets == 0)
+
+-- maps agree with tables over random inserts and deletes
+map = data.map{layout = {key = {0, 16}}, fields = {'key'}, capacity = 64}
+local t, d = {}, data.new(2)
+d:layout{key = {0, 16}}
+for i = 1, 5000 do
+	d.key = math.random(0, 63) * 257
+	if math.random() < 0.3 then
+		assert(map:delete(d) == (t[d.key] ~= nil))
+		t[d.key] = nil
+	else
+		map:upsert(d, i)
+		t[d.key] = i
+	end
+	assert(map:get(d) == t[d.key])
+end
+local n = 0
+for key in pairs(t) do
+	d.key = key
+	assert(map:get(d) == t[key])
+	n = n + 1
+end
+assert(#map == n)
+
 -- create a new data object from a string
 d = data.new'\a'
 d:layout{ascii = {1, 7}} 
@@ -126,6 +500,433 @@ assert(d6.overflow == nil)
 d6.str = "hij"
 assert(d6.str == "hijdef")
 
+-- copy bytes between data objects
+d7 = data.new{0x01, 0x02, 0x03, 0x04}
+d8 = data.new(4)
+assert(d7:copy(d8) == d8)
+assert(tostring(d8) == tostring(d7))
+
+-- copy a range into a destination offset
+d8:fill(0)
+assert(d7:copy(d8, 1, 2, 2) == d8)
+assert(tostring(d8) == "\0\0\2\3")
+
+-- copy out of the source or destination bounds
+assert(d7:copy(d8, 3, 0, 2) == nil)
+assert(d7:copy(d8, 0, 3, 2) == nil)
+assert(d7:copy(d8, 0, 0, -1) == nil)
+
+-- copy between overlapping segments of the same data
+d7:segment(0, 3):copy(d7:segment(1, 3))
+assert(tostring(d7) == "\1\1\2\3")
+
+-- fill a range of a data object
+d8 = data.new(4)
+assert(d8:fill(0xff, 1, 2) == d8)
+assert(tostring(d8) == "\0\255\255\0")
+assert(d8:fill(0xaa, 2) == d8)
+assert(tostring(d8) == "\0\255\170\170")
+assert(d8:fill(0, 4) == nil)
+
+-- fill a segment does not touch bytes outside of its window
+d8:segment(1, 2):fill(0x11)
+assert(tostring(d8) == "\0\17\17\170")
+
+-- compare data objects
+assert(data.new'abc':compare(data.new'abc') == 0)
+assert(data.new'abc':compare(data.new'abd') == -1)
+assert(data.new'abd':compare(data.new'abc') == 1)
+assert(data.new'ab':compare(data.new'abc') == -1)
+assert(data.new'abc':compare('abc') == nil)
+
+-- compare data objects using relational operators
+assert(data.new'abc' == data.new'abc')
+assert(data.new'abc' ~= data.new'abd')
+assert(data.new'abc' < data.new'abd')
+assert(data.new'ab' <= data.new'abc')
+assert(not (data.new'abd' < data.new'abc'))
+assert(data.new'xabcx':segment(1, 3) == data.new'abc')
+
+-- extract a range of bytes as a string
+d9 = data.new'abcdef'
+assert(d9:tostring() == 'abcdef')
+assert(d9:tostring(2) == 'cdef')
+assert(d9:tostring(1, 3) == 'bcd')
+assert(d9:segment(1, 4):tostring(1, 2) == 'cd')
+assert(d9:tostring(4, 3) == nil)
+assert(d9:tostring(6) == nil)
+assert(d9:tostring(nil, 3) == 'abc' and d9:tostring(2, nil) == 'cdef')
+assert(d9:tostring(nil, nil, nil) == 'abcdef')
+
+-- share the bytes of a data object with a string
+d9 = data.new(string.rep('a', 64))
+s = d9:tostring(16, 48, true)
+assert(s == string.rep('a', 48))
+d9:layout{str = {0, 1, 's'}}
+d9.str = 'b'
+if _VERSION >= 'Lua 5.5' then
+	-- shared data is read-only
+	assert(d9.str == 'a')
+	assert(d9:fill(0) == nil)
+else
+	assert(d9.str == 'b')
+end
+
+-- the data object is writable again once the string is collected
+s = d9:tostring(nil, nil, true)
+s = nil
+collectgarbage()
+d9.str = 'b'
+assert(d9.str == 'b')
+
+-- the string outlives the data object
+s = d9:tostring(16, 48, true)
+d9 = nil
+collectgarbage()
+assert(s == string.rep('a', 48))
+
+-- encode a range of bytes as hex
+d9 = data.new{0x00, 0x01, 0x7f, 0x80, 0xab, 0xff}
+assert(d9:hex() == '00017f80abff')
+assert(d9:hex(2) == '7f80abff')
+assert(d9:hex(1, 2) == '017f')
+assert(d9:segment(2, 3):hex(1) == '80ab')
+assert(d9:hex(4, 3) == nil)
+
+-- encode as base64 (RFC 4648 test vectors)
+for plain, encoded in pairs{f = 'Zg==', fo = 'Zm8=', foo = 'Zm9v',
+	foob = 'Zm9vYg==', fooba = 'Zm9vYmE=', foobar = 'Zm9vYmFy'} do
+	assert(data.new(plain):base64() == encoded)
+	assert(data.frombase64(encoded):tostring() == plain)
+end
+assert(data.new'xfoobarx':base64(1, 6) == 'Zm9vYmFy')
+
+-- decode hex and base64 into new data objects
+d9 = data.fromhex'00017F80abFF'
+assert(d9 == data.new{0x00, 0x01, 0x7f, 0x80, 0xab, 0xff})
+assert(data.frombase64'Zm9vYg' == data.new'foob')
+assert(data.frombase64'Zm9vYmE' == data.new'fooba')
+
+-- round trip random bytes of every length across the vectorized widths
+for len = 1, 100 do
+	local t = {}
+	for i = 1, len do t[i] = math.random(0, 255) end
+	d9 = data.new(t)
+
+	local hex = d9:hex()
+	assert(hex == string.format(string.rep('%02x', len),
+		(table.unpack or unpack)(t)))
+	assert(data.fromhex(hex) == d9)
+	assert(data.fromhex(hex:upper()) == d9)
+
+	local base64 = d9:base64()
+	assert(#base64 == math.ceil(len / 3) * 4)
+	assert(data.frombase64(base64) == d9)
+end
+
+-- encode data larger than a Lua buffer
+d9 = data.new(string.rep('\xfb\xff\xbf', 1000))
+assert(d9:hex() == string.rep('fbffbf', 1000))
+assert(d9:base64() == string.rep('+/+/', 1000))
+assert(data.frombase64(string.rep('+/+/', 1000)) == d9)
+
+-- check invalid hex and base64
+assert(data.fromhex'' == nil)
+assert(data.fromhex'abc' == nil)
+assert(data.fromhex'0g' == nil)
+assert(data.fromhex' 00' == nil)
+assert(data.frombase64'' == nil)
+assert(data.frombase64'Z' == nil)
+assert(data.frombase64'Zm9vY' == nil)
+assert(data.frombase64'Zg=a' == nil)
+assert(data.frombase64'Z===' == nil)
+assert(data.frombase64'Zm=v' == nil)
+assert(data.frombase64'Zh==' == nil)
+assert(data.frombase64'Zm9v\n' == nil)
+assert(data.frombase64'Zm-v' == nil)
+
+-- check copy-on-write segments
+d = data.new{0x01, 0x02, 0x03, 0x04}
+d:layout{byte = {0, 8}}
+c = d:cow_segment(1, 2)
+c:layout{byte = {0, 8}}
+assert(#c == 2 and c.byte == 0x02)
+
+-- parent writes are seen until the first write of the segment
+d:layout{second = {8, 8}}
+d.second = 0x22
+assert(c.byte == 0x22)
+
+c.byte = 0xFF
+assert(c.byte == 0xFF and d.second == 0x22)
+d.second = 0x02
+assert(c.byte == 0xFF)
+
+-- out of bounds writes do not unshare the segment
+c = d:cow_segment(1, 2)
+l = data.layout{far = {24, 8}, near = {8, 8}}
+c:layout(l)
+c.far = 0xFF
+l:accessor('far')(c, 0xFF)
+d.second = 0x33
+assert(c:tostring() == '\x33\x03')
+
+-- writes through accessors of other layouts unshare only the segment
+l:accessor('near')(d:cow_segment(1, 2), 0xFF)
+c:layout{byte = {0, 8}}
+l:accessor('near')(c, 0xCC)
+assert(c:tostring() == '\x33\xCC' and d:tostring() == '\1\x33\3\4')
+d.second = 0x02
+
+-- child segments inherit copy-on-write
+c = d:cow_segment()
+s = c:segment(3)
+assert(s:fill(0xEE) == s)
+assert(d:tostring() == '\1\2\3\4' and c:tostring() == '\1\2\3\4')
+assert(s:tostring() == '\238')
+
+-- copy-on-write segments of read-only data are writable
+if _VERSION >= 'Lua 5.5' then
+	d = data.new'abc'
+	local str = d:tostring(0, 3, true)
+	c = d:cow_segment()
+	assert(d:fill(0) == nil and c:fill(0) == c)
+	assert(str == 'abc' and c:tostring() == '\0\0\0')
+end
+
+-- check arena allocation
+a = data.arena(256)
+d1 = a:new(4)
+d2 = a:new{0xAB, 0xCD}
+d3 = a:new'abc'
+assert(#d1 == 4 and #d2 == 2 and tostring(d3) == 'abc')
+d2:layout{byte = {0, 8}}
+assert(d2.byte == 0xAB)
+d4 = d1:segment(1, 2)
+assert(#d4 == 2)
+
+-- arena is exhausted
+assert(a:new(256) == nil)
+
+-- data allocated before reset is no longer accessible
+assert(a:reset() == a)
+assert(d2.byte == nil)
+assert(d1:segment() == nil)
+assert(d4:tostring() == nil)
+assert(d1:fill(0) == nil)
+d2.byte = 0
+assert(d2.byte == nil)
+
+-- the arena can be reused after reset
+d1 = a:new(128)
+assert(#d1 == 128 and d1:segment(0, 128))
+
+-- check invalid arena creation
+assert(data.arena(0) == nil)
+assert(a:new(0) == nil)
+
+-- data objects keep the arena alive
+a = nil
+collectgarbage()
+d1:layout{byte = {0, 8}}
+d1.byte = 1
+assert(d1.byte == 1)
+d1, d2, d3, d4 = nil, nil, nil, nil
+collectgarbage()
+
+-- check ring buffer
+r = data.ring(100)
+assert(r:enqueue'abc')
+assert(r:enqueue(data.new{0x01, 0x02}))
+assert(r:enqueue'defgh')
+
+-- records are dequeued as segments, in order
+d1, d2 = r:dequeue(2)
+assert(d1:tostring() == 'abc')
+assert(#d2 == 2)
+d2:layout{byte = {0, 8}}
+assert(d2.byte == 0x01)
+
+-- segments of a batch are invalidated by the next dequeue
+d3, d4 = r:dequeue(2)
+assert(d3:tostring() == 'defgh' and d4 == nil)
+assert(d1:tostring() == nil and d2.byte == nil)
+assert(r:dequeue() == nil)
+
+-- capacity is rounded up to a power of two (128); records wrap around
+for i = 1, 100 do
+	local s = string.rep(string.char(i), i % 20 + 1)
+	assert(r:enqueue(s))
+	assert(r:dequeue():tostring() == s)
+end
+
+-- ring is full
+local n = 0
+while r:enqueue'0123456789' do n = n + 1 end
+assert(n > 0 and n < 8)
+assert(select('#', r:dequeue(n + 1)) == n)
+
+-- check invalid rings and records
+assert(data.ring(0) == nil)
+assert(r:enqueue'' == nil)
+assert(r:enqueue(string.rep('x', 128)) == nil)
+
+-- check pcap capture files
+local path = os.tmpname()
+os.remove(path)
+local w = data.pcap_writer(path)
+assert(w:write(data.new{1, 2, 3}, 10, 500))
+assert(w:write(data.new'abcdefgh':segment(2, 4), 11, 999999999, 60))
+assert(w:write'xyz')
+assert(w:flush())
+
+-- appending requires the same link type
+assert(data.pcap_writer(path, 101) == nil)
+w:close()
+assert(w:write'x' == nil)
+
+-- records larger than the buffer are written through
+w = data.pcap_writer(path)
+assert(w:write(string.rep('z', 70000), 12, 0))
+w:close()
+
+-- packets are read as segments of the mapped file, by a single cursor
+local p = data.pcap_open(path)
+local packets, cursor = {}, nil
+for pkt, sec, nsec, len, linktype in p:packets() do
+	assert(cursor == nil or pkt == cursor)
+	cursor = pkt
+	packets[#packets + 1] = {pkt:tostring(), sec, nsec, len, linktype}
+end
+assert(#packets == 4)
+assert(packets[1][1] == '\1\2\3' and packets[1][2] == 10)
+assert(packets[1][3] == 500 and packets[1][4] == 3 and packets[1][5] == 1)
+assert(packets[2][1] == 'cdef' and packets[2][2] == 11)
+assert(packets[2][3] == 999999999 and packets[2][4] == 60)
+assert(packets[3][1] == 'xyz' and packets[3][2] > 0)
+assert(packets[4][1] == string.rep('z', 70000) and packets[4][2] == 12)
+
+-- packets are read-only and inaccessible once the file is closed
+local pkt = p:packets()()
+pkt:layout{byte = {0, 8}}
+pkt.byte = 0xff
+assert(pkt.byte == 1)
+p:close()
+assert(pkt.byte == nil)
+assert(p:packets() == nil)
+os.remove(path)
+
+local function le(n, v)
+	local t = {}
+	for i = 1, n do
+		t[i] = v % 256
+		v = math.floor(v / 256)
+	end
+	return string.char((table.unpack or unpack)(t))
+end
+
+local function be(n, v)
+	return le(n, v):reverse()
+end
+
+local function block(enc, type, body)
+	body = body .. string.rep('\0', -#body % 4)
+	return enc(4, type) .. enc(4, #body + 12) .. body .. enc(4, #body + 12)
+end
+
+local function section(enc)
+	return block(enc, 0x0a0d0d0a, enc(4, 0x1a2b3c4d) .. enc(2, 1) ..
+		enc(2, 0) .. string.rep('\255', 8))
+end
+
+local function read_capture(bytes)
+	local f = io.open(path, 'wb')
+	f:write(bytes)
+	f:close()
+
+	local packets = {}
+	local p = data.pcap_open(path)
+	if p == nil then return nil end
+	for pkt, sec, nsec, len, linktype in p:packets() do
+		packets[#packets + 1] = {pkt:tostring(), sec, nsec, len, linktype}
+	end
+	p:close()
+	os.remove(path)
+	return packets
+end
+
+-- big-endian pcap with microsecond timestamps, and a truncated record
+packets = read_capture(be(4, 0xa1b2c3d4) .. be(2, 2) .. be(2, 4) ..
+	be(4, 0) .. be(4, 0) .. be(4, 0xffff) .. be(4, 101) ..
+	be(4, 1) .. be(4, 2) .. be(4, 2) .. be(4, 4) .. 'hi' ..
+	be(4, 3) .. be(4, 4))
+assert(#packets == 1 and packets[1][1] == 'hi' and packets[1][2] == 1)
+assert(packets[1][3] == 2000 and packets[1][4] == 4 and packets[1][5] == 101)
+
+-- pcapng sections of either byte order, with per-interface resolutions
+packets = read_capture(section(le) ..
+	block(le, 1, le(2, 1) .. le(2, 0) .. le(4, 0) ..
+		le(2, 9) .. le(2, 1) .. '\9\0\0\0' .. le(4, 0)) ..
+	block(le, 1, le(2, 101) .. le(2, 0) .. le(4, 2)) ..
+	block(le, 0xbad, 'skipped') ..
+	block(le, 6, le(4, 0) .. le(4, 1) .. le(4, 705032711) ..
+		le(4, 3) .. le(4, 3) .. 'abc') ..
+	block(le, 3, le(4, 5) .. 'hello') ..
+	block(le, 6, le(4, 1) .. le(4, 0) .. le(4, 3000250) ..
+		le(4, 2) .. le(4, 9) .. 'de') ..
+	section(be) ..
+	block(be, 1, be(2, 1) .. be(2, 0) .. be(4, 0)) ..
+	block(be, 6, be(4, 0) .. be(4, 0) .. be(4, 7000000) ..
+		be(4, 2) .. be(4, 2) .. 'be') ..
+	be(4, 6) .. be(4, 32))
+assert(#packets == 4)
+assert(packets[1][1] == 'abc' and packets[1][2] == 5 and packets[1][3] == 7)
+assert(packets[2][1] == 'hello' and packets[2][2] == 0)
+assert(packets[3][1] == 'de' and packets[3][2] == 3)
+assert(packets[3][3] == 250000 and packets[3][4] == 9)
+assert(packets[3][5] == 101)
+assert(packets[4][1] == 'be' and packets[4][2] == 7 and packets[4][5] == 1)
+
+-- check invalid capture files
+packets = read_capture(section(le) ..
+	block(le, 6, le(4, 0) .. le(4, 0) .. le(4, 0) .. le(4, 1) ..
+		le(4, 1) .. 'x'))
+assert(#packets == 0)
+assert(read_capture(string.rep('\0', 64)) == nil)
+assert(data.pcap_open(path) == nil)
+
+-- check runtime statistics, if enabled
+if data.stats() then
+	collectgarbage()
+	local before = data.stats()
+
+	local d = data.new(4)
+	local s = d:segment(0, 2)
+	d:layout{uint32 = {0, 32}, str = {0, 2, 's'}, overflow = {24, 16}}
+	d.uint32 = d.uint32
+	assert(d.str and d.overflow == nil)
+
+	local stats = data.stats()
+	assert(stats.data == before.data + 2)
+	assert(stats.segments == before.segments + 1)
+	assert(stats.handles == before.handles + 1)
+	assert(stats.bytes == before.bytes + 4)
+	assert(stats.allocs == before.allocs + 2)
+	assert(stats.number_reads == before.number_reads + 2)
+	assert(stats.number_writes == before.number_writes + 1)
+	assert(stats.string_reads == before.string_reads + 1)
+	assert(stats.misses == before.misses + 1)
+
+	d, s = nil, nil
+	collectgarbage()
+	stats = data.stats()
+	assert(stats.data == before.data)
+	assert(stats.segments == before.segments)
+	assert(stats.handles == before.handles)
+	assert(stats.bytes == before.bytes)
+	assert(stats.frees == before.frees + 2)
+end
+
 -- check invalid data creation 
 d = data.new()
 assert(d == nil)
@@ -0,0 +1,304 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <time.h>
+#include <sys/param.h>
+
+#include <sys/endian.h>
+
+#include "binary.h"
+
+/*
+ * usage: test_binary [check [rounds [seed]] | bench [iterations]]
+ *
+ * check compares every variant of binary_get_uint64() and binary_set_uint64()
+ * against a bitwise reference implementation over random inputs, for every
+ * (offset mod 8, width, endian) combination; bench measures the variants over
+ * the same combinations and prints CSV. check also compares the extraction
+ * of fields from a whole word, as done for fused layout entries, and round
+ * trips LEB128 varints of every width through every padded size.
+ */
+
+#define BUFFER_SIZE	(16)
+#define MAX_WIDTH	(64)
+#define MAX_OFFSET	(BYTE_TO_BIT(BUFFER_SIZE) - MAX_WIDTH)
+
+typedef uint64_t (*get_t)(byte_t *, size_t, size_t, int);
+typedef void (*set_t)(byte_t *, size_t, size_t, int, uint64_t);
+
+typedef struct {
+	const char *name;
+	get_t       get;
+	set_t       set;
+} variant_t;
+
+/* new variants of binary.c kernels should be added here */
+static const variant_t variants[ ] = {
+	{"binary", binary_get_uint64, binary_set_uint64},
+	{NULL    , NULL             , NULL}
+};
+
+static uint64_t seed = 0x9e3779b97f4a7c15ULL;
+
+static uint64_t
+random64(void)
+{
+	/* xorshift64 */
+	seed ^= seed << 13;
+	seed ^= seed >> 7;
+	seed ^= seed << 17;
+	return seed;
+}
+
+static void
+random_bytes(byte_t *bytes, size_t size)
+{
+	for (size_t i = 0; i < size; i++)
+		bytes[ i ] = (byte_t) random64();
+}
+
+static int
+get_bit(byte_t *bytes, size_t pos)
+{
+	return (bytes[ pos / BYTE_BIT ] >> (BYTE_BIT - 1 - pos % BYTE_BIT)) & 1;
+}
+
+static void
+set_bit(byte_t *bytes, size_t pos, int bit)
+{
+	byte_t mask = 1 << (BYTE_BIT - 1 - pos % BYTE_BIT);
+
+	if (bit)
+		bytes[ pos / BYTE_BIT ] |= mask;
+	else
+		bytes[ pos / BYTE_BIT ] &= ~mask;
+}
+
+/*
+ * reference: bits are numbered MSB 0; a little-endian field is a sequence of
+ * byte-sized chunks (the last one may be partial), where the first chunk is
+ * the least significant one
+ */
+static uint64_t
+reference_get(byte_t *bytes, size_t offset, size_t width, int endian)
+{
+	uint64_t value = 0;
+
+	if (width <= BYTE_BIT || endian != LITTLE_ENDIAN) {
+		for (size_t i = 0; i < width; i++)
+			value = (value << 1) | get_bit(bytes, offset + i);
+		return value;
+	}
+
+	for (size_t chunk = 0; chunk * BYTE_BIT < width; chunk++) {
+		size_t start = chunk * BYTE_BIT;
+		size_t end   = MIN(start + BYTE_BIT, width);
+
+		uint64_t bits = 0;
+		for (size_t i = start; i < end; i++)
+			bits = (bits << 1) | get_bit(bytes, offset + i);
+
+		value |= bits << start;
+	}
+	return value;
+}
+
+static void
+reference_set(byte_t *bytes, size_t offset, size_t width, int endian,
+	uint64_t value)
+{
+	if (width <= BYTE_BIT || endian != LITTLE_ENDIAN) {
+		for (size_t i = 0; i < width; i++)
+			set_bit(bytes, offset + i, (value >> (width - 1 - i)) & 1);
+		return;
+	}
+
+	for (size_t chunk = 0; chunk * BYTE_BIT < width; chunk++) {
+		size_t start = chunk * BYTE_BIT;
+		size_t end   = MIN(start + BYTE_BIT, width);
+
+		for (size_t i = start; i < end; i++)
+			set_bit(bytes, offset + i,
+				(value >> (start + end - 1 - i)) & 1);
+	}
+}
+
+#define WIDTH_MASK(width) \
+	(width == MAX_WIDTH ? UINT64_MAX : (UINT64_C(1) << width) - 1)
+
+static const int endians[ ] = {BIG_ENDIAN, LITTLE_ENDIAN};
+
+#define ENDIAN_NAME(endian) (endian == BIG_ENDIAN ? "big" : "little")
+
+static int
+check_variant(const variant_t *variant, size_t offset, size_t width,
+	int endian)
+{
+	byte_t bytes[ BUFFER_SIZE ];
+	byte_t expected[ BUFFER_SIZE ];
+
+	random_bytes(bytes, BUFFER_SIZE);
+
+	uint64_t value = variant->get(bytes, offset, width, endian);
+	uint64_t reference = reference_get(bytes, offset, width, endian);
+	if (value != reference) {
+		printf("%s_get: offset %zu, width %zu, %s endian: "
+			"got 0x%jx, expected 0x%jx\n", variant->name, offset,
+			width, ENDIAN_NAME(endian), (uintmax_t) value,
+			(uintmax_t) reference);
+		return 1;
+	}
+
+	/* bits beyond the field width must be ignored */
+	value = random64();
+	if (random64() & 1)
+		value &= WIDTH_MASK(width);
+
+	memcpy(expected, bytes, BUFFER_SIZE);
+	reference_set(expected, offset, width, endian, value);
+	variant->set(bytes, offset, width, endian, value);
+	if (memcmp(bytes, expected, BUFFER_SIZE) != 0) {
+		printf("%s_set: offset %zu, width %zu, %s endian: "
+			"value 0x%jx mismatch\n", variant->name, offset, width,
+			ENDIAN_NAME(endian), (uintmax_t) value);
+		return 1;
+	}
+	return 0;
+}
+
+/* big-endian fields and single bytes lying within a word */
+static int
+check_extract(size_t offset, size_t width)
+{
+	byte_t bytes[ BUFFER_SIZE ];
+
+	random_bytes(bytes, BUFFER_SIZE);
+
+	size_t word_offset = offset % BINARY_WORD_BIT;
+	if (word_offset + width > BINARY_WORD_BIT)
+		return 0;
+
+	size_t   shift = BINARY_WORD_BIT - word_offset - width;
+	uint64_t word  = binary_get_word(bytes + offset / BINARY_WORD_BIT *
+		BINARY_WORD_BYTE);
+	uint64_t value = BINARY_EXTRACT(word, shift, width);
+	uint64_t reference = reference_get(bytes, offset, width, BIG_ENDIAN);
+	if (value != reference) {
+		printf("extract: offset %zu, width %zu: got 0x%jx, "
+			"expected 0x%jx\n", offset, width, (uintmax_t) value,
+			(uintmax_t) reference);
+		return 1;
+	}
+	return 0;
+}
+
+static int
+check_varint(size_t width)
+{
+	byte_t   bytes[ BINARY_VARINT_MAX ];
+	uint64_t value = random64() & WIDTH_MASK(width);
+	size_t   size = CEIL_DIV(MAX(width, 1), 7);
+
+	for (; size <= BINARY_VARINT_MAX; size++) {
+		uint64_t decoded = ~value;
+
+		if (!binary_set_varint(bytes, size, value) ||
+		    binary_get_varint(bytes, BINARY_VARINT_MAX, &decoded) != size ||
+		    decoded != value ||
+		    binary_get_varint(bytes, size - 1, &decoded) != 0) {
+			printf("varint: value 0x%jx, size %zu mismatch\n",
+				(uintmax_t) value, size);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static int
+check(long rounds)
+{
+	int failures = 0;
+
+	for (long round = 0; round < rounds; round++)
+	for (size_t width = 1; width <= MAX_WIDTH; width++)
+		failures += check_extract(random64() % (MAX_OFFSET + 1), width);
+
+	for (long round = 0; round < rounds; round++)
+	for (size_t width = 1; width <= MAX_WIDTH; width++)
+		failures += check_varint(width);
+
+	for (const variant_t *variant = variants; variant->name; variant++)
+	for (long round = 0; round < rounds; round++)
+	for (size_t width = 1; width <= MAX_WIDTH; width++)
+	for (size_t e = 0; e < sizeof(endians) / sizeof(int); e++) {
+		size_t offset = random64() % (MAX_OFFSET + 1);
+		failures += check_variant(variant, offset, width, endians[ e ]);
+	}
+
+	if (failures > 0) {
+		printf("%d failures\n", failures);
+		return 1;
+	}
+
+	printf("test passed ;-)\n");
+	return 0;
+}
+
+static double
+now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* keeps the compiler from dropping the benchmarked calls */
+static volatile uint64_t sink;
+
+static void
+bench(long n)
+{
+	byte_t bytes[ BUFFER_SIZE ];
+	random_bytes(bytes, BUFFER_SIZE);
+
+	printf("variant,op,offset,width,endian,ns_per_op\n");
+
+	for (const variant_t *variant = variants; variant->name; variant++)
+	for (size_t offset = 0; offset < BYTE_BIT; offset++)
+	for (size_t width = 1; width <= MAX_WIDTH; width++)
+	for (size_t e = 0; e < sizeof(endians) / sizeof(int); e++) {
+		int endian = endians[ e ];
+
+		double start = now();
+		for (long i = 0; i < n; i++)
+			sink += variant->get(bytes, offset, width, endian);
+		double get = (now() - start) / n * 1e9;
+
+		start = now();
+		for (long i = 0; i < n; i++)
+			variant->set(bytes, offset, width, endian, i);
+		double set = (now() - start) / n * 1e9;
+
+		printf("%s,get,%zu,%zu,%s,%.2f\n", variant->name, offset,
+			width, ENDIAN_NAME(endian), get);
+		printf("%s,set,%zu,%zu,%s,%.2f\n", variant->name, offset,
+			width, ENDIAN_NAME(endian), set);
+	}
+}
+
+int
+main(int argc, char *argv[ ])
+{
+	if (argc > 1 && strcmp(argv[1], "bench") == 0) {
+		bench(argc > 2 ? atol(argv[2]) : 100000);
+		return 0;
+	}
+
+	long rounds = argc > 2 ? atol(argv[2]) : 1000;
+	if (argc > 3)
+		seed = strtoull(argv[3], NULL, 0);
+
+	return check(rounds);
+}